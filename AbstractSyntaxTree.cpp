@@ -9,8 +9,8 @@ ASTNumber::ASTNumber (int val) : value(val) {}
 
 ASTString::ASTString ( const std::string &str ) : str(str) {}
 
-ASTArray::ASTArray(std::unique_ptr<ASTNumber> lower,
-	std::unique_ptr<ASTNumber> upper,
+ASTArray::ASTArray(std::unique_ptr<ASTExpression> lower,
+	std::unique_ptr<ASTExpression> upper,
 	std::shared_ptr<ASTVariableType> type)
 : lowerIdx(std::move(lower)), upperIdx(std::move(upper)), type(type) {}
 
@@ -19,8 +19,11 @@ ASTBody::ASTBody ( std::vector<std::unique_ptr<ASTExpression>> content ) : conte
 ASTVariable::ASTVariable (const std::string & name,std::shared_ptr<ASTVariableType> type)
 	: name(name), type(type) {}
 
-ASTConstVariable::ASTConstVariable ( const std::string & name, int value )
-	: name(name), value(value) {}
+ASTParameter::ASTParameter (const std::string & name, std::shared_ptr<ASTVariableType> type, Mode mode)
+	: ASTVariable(name, type), mode(mode) {}
+
+ASTConstVariable::ASTConstVariable ( const std::string & name, std::unique_ptr<ASTExpression> value )
+	: name(name), value(std::move(value)) {}
 
 
 
@@ -29,7 +32,7 @@ ASTFunctionCall::ASTFunctionCall(const std::string & name,
 	: name(name), arguments(std::move(args)) {}
 
 ASTFunctionPrototype::ASTFunctionPrototype(const std::string & name,
-	std::vector<std::unique_ptr<ASTVariable>> params,
+	std::vector<std::unique_ptr<ASTParameter>> params,
 	std::shared_ptr<ASTVariableType> ret)
 	: returnType(ret), parameters(std::move(params)), name(name) {}
 
@@ -40,6 +43,8 @@ ASTFunction::ASTFunction(std::unique_ptr<ASTFunctionPrototype> proto,
 	std::unique_ptr<ASTBody> body)
 	: prototype(std::move(proto)), local_variables(std::move(local)), body(std::move(body)) {}
 
+const std::string & ASTFunction::getName() const { return prototype -> getName(); }
+
 
 
 
@@ -72,8 +77,8 @@ ASTReference::ASTReference ( const std::string &name ) : name(name) {}
 
 ASTSingleVarReference::ASTSingleVarReference ( const std::string &name ) : ASTReference(name) {}
 
-ASTArrayReference::ASTArrayReference ( const std::string &name, std::unique_ptr<ASTExpression> idx ) :
-	ASTReference(name), index(std::move(idx)) {}
+ASTArrayReference::ASTArrayReference ( const std::string &name, std::unique_ptr<ASTExpression> idx, bool range_checked ) :
+	ASTReference(name), index(std::move(idx)), range_checked(range_checked) {}
 
 
 
@@ -9,9 +9,18 @@
 
 
 #include "Lexan.h"
+#include "Options.h"
+#include "Report.h"
+#include "Resolver.h"
 
 using namespace llvm;
 
+struct Effects;
+class EffectAnalysis;
+class ASTFunctionPrototype;
+class ConstantEvaluator;
+class Interpreter;
+class BytecodeCompiler;
 
 
 class ASTExpression
@@ -19,6 +28,33 @@ class ASTExpression
 public:
 	virtual ~ASTExpression () = default;
 	virtual Value * codegen() = 0;
+
+	// Boolean expressions (comparisons and their and/or) are i1 in conditions and -1/0 as integers
+	virtual bool isBoolean() const { return false; }
+	/**
+	 * Generates the expression as a condition, jumping to if_true when it is nonzero
+	 * @return false on failure
+	 */
+	virtual bool codegenBranch(BasicBlock * if_true, BasicBlock * if_false);
+	// Adds the variables the expression reads and writes and the routines it calls
+	virtual void collectEffects(Effects & effects) {}
+	// Marks the self calls of routine after which it returns, tail is set for its last statement
+	// @return whether a call was marked
+	virtual bool markTailCalls(const ASTFunctionPrototype & routine, bool tail) { return false; }
+	// Runs the expression at compile time, throws NotConstant when that isn't possible
+	virtual int evaluate(ConstantEvaluator & evaluator);
+	// Binds the names the expression uses to their slots before the interpreter runs it
+	virtual void resolve(Resolver & resolver) {}
+	// Runs the expression on the interpreter, statements give 0
+	virtual int interpret(Interpreter & interpreter);
+	/**
+	 * Compiles the expression to bytecode
+	 * @param target register the value should be computed into, -1 for any
+	 * @return the register holding the value, -1 for statements
+	 */
+	virtual int compile(BytecodeCompiler & compiler, int target);
+	// Jumps to label when the expression is nonzero (jump_if) or zero, falls through otherwise
+	virtual void compileBranch(BytecodeCompiler & compiler, bool jump_if, unsigned label);
 };
 
 // Number literals
@@ -27,6 +63,9 @@ class ASTNumber : public ASTExpression
 public:
 	ASTNumber ( int val );
 	Value *codegen() override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
 	int value;
 };
 
@@ -36,6 +75,7 @@ class ASTString : public ASTExpression
 public:
 	ASTString(const std::string & str);
 	Value * codegen() override;
+	void resolve(Resolver & resolver) override;
 	std::string str;
 };
 
@@ -55,10 +95,15 @@ public:
 class ASTArray : public ASTVariableType
 {
 public:
-	ASTArray(std::unique_ptr<ASTNumber> lower, std::unique_ptr<ASTNumber> upper, std::shared_ptr<ASTVariableType> type);
+	ASTArray(std::unique_ptr<ASTExpression> lower, std::unique_ptr<ASTExpression> upper, std::shared_ptr<ASTVariableType> type);
 	Type * codegen();
-	std::unique_ptr<ASTNumber> lowerIdx, upperIdx;
+	std::unique_ptr<ASTExpression> lowerIdx, upperIdx;
+	// Values of the bounds, known after codegen
+	int lower = 0, upper = -1;
 private:
+	friend class ConstantEvaluator;
+	friend class Resolver;
+
 	std::shared_ptr<ASTVariableType> type;
 };
 
@@ -68,6 +113,12 @@ class ASTBody
 public:
 	ASTBody(std::vector<std::unique_ptr<ASTExpression>> content);
 	Value * codegen();
+	void collectEffects(Effects & effects);
+	bool markTailCalls(const ASTFunctionPrototype & routine, bool tail);
+	int evaluate(ConstantEvaluator & evaluator);
+	void resolve(Resolver & resolver);
+	int interpret(Interpreter & interpreter);
+	void compile(BytecodeCompiler & compiler);
 
 	std::vector<std::unique_ptr<ASTExpression>> content;
 };
@@ -90,15 +141,26 @@ public:
 private:
 };
 
+// Routine parameter, var and const parameters are passed by reference
+class ASTParameter : public ASTVariable
+{
+public:
+	enum Mode { value, var, constant };
+
+	ASTParameter (const std::string & name, std::shared_ptr<ASTVariableType> type, Mode mode );
+
+	const Mode mode;
+};
+
 // Const Variable
 class ASTConstVariable : public ASTVariableDef
 {
 public:
-	ASTConstVariable (const std::string & name, int value );
+	ASTConstVariable (const std::string & name, std::unique_ptr<ASTExpression> value );
 	Value * codegen() override;
 
 	const std::string name;
-	const int value;
+	const std::unique_ptr<ASTExpression> value;
 private:
 };
 
@@ -113,7 +175,29 @@ class ASTFunctionCall : public ASTExpression
 public:
 	ASTFunctionCall( const std::string & name, std::vector<std::unique_ptr<ASTExpression>> args );
 	Value * codegen() override;
+	void collectEffects(Effects & effects) override;
+	bool markTailCalls(const ASTFunctionPrototype & routine, bool tail) override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	void resolve(Resolver & resolver) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
+
+	bool isCallOf(const std::string & routine) const { return name == routine; }
+	// Self call in tail position, generated as a jump to the start of the routine
+	bool tail_call = false;
+
+	// Set by the Resolver: the built in procedure or the routine called
+	enum class Callee { routine, writeln, write, readln, dec };
+	Callee callee = Callee::routine;
+	unsigned routine_index = 0;
+	// Set by the Resolver: a tail call the interpreter runs in the caller's frame
+	bool reuses_frame = false;
 private:
+	friend class EffectAnalysis;
+
+	bool canReuseFrame() const;
+	Value * codegenTailRecursion();
+
 	std::string name;
 	std::vector<std::unique_ptr<ASTExpression>> arguments;
 };
@@ -122,12 +206,12 @@ private:
 class ASTFunctionPrototype
 {
 public:
-	ASTFunctionPrototype(const std::string & name, std::vector<std::unique_ptr<ASTVariable>> params, std::shared_ptr<ASTVariableType> ret);
+	ASTFunctionPrototype(const std::string & name, std::vector<std::unique_ptr<ASTParameter>> params, std::shared_ptr<ASTVariableType> ret);
 	Function * codegen ();
 
 	const std::string & getName () const;
 	std::shared_ptr<ASTVariableType> returnType;
-	std::vector<std::unique_ptr<ASTVariable>> parameters;
+	std::vector<std::unique_ptr<ASTParameter>> parameters;
 
 private:
 	std::string name;
@@ -141,8 +225,15 @@ public:
 	             std::vector<std::unique_ptr<ASTVariable>> local,
 	             std::unique_ptr<ASTBody> body );
 	Function * codegen ();
+	const std::string & getName () const;
 
 private:
+	friend class EffectAnalysis;
+	friend class ConstantEvaluator;
+	friend class Resolver;
+	friend class Interpreter;
+	friend class BytecodeCompiler;
+
 	std::unique_ptr<ASTFunctionPrototype> prototype;
 	std::vector<std::unique_ptr<ASTVariable>> local_variables;
 	std::unique_ptr<ASTBody> body;
@@ -157,6 +248,12 @@ public:
 	      std::unique_ptr<ASTBody> then_body,
 	      std::unique_ptr<ASTBody> else_body);
 	Value * codegen() override;
+	void collectEffects(Effects & effects) override;
+	bool markTailCalls(const ASTFunctionPrototype & routine, bool tail) override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	void resolve(Resolver & resolver) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
 private:
 	std::unique_ptr<ASTExpression> condition;
 	std::unique_ptr<ASTBody> then_body, else_body;
@@ -173,11 +270,19 @@ public:
 		bool downto);
 
 	Value * codegen() override;
+	void collectEffects(Effects & effects) override;
+	bool markTailCalls(const ASTFunctionPrototype & routine, bool tail) override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	void resolve(Resolver & resolver) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
 private:
 	const std::string variable_name;
 	std::unique_ptr<ASTExpression> start, end, step;
 	std::unique_ptr<ASTBody> body;
 	bool downto;
+	// Set by the Resolver
+	VariableSlot control;
 };
 
 class ASTWhile : public ASTExpression
@@ -186,6 +291,12 @@ public:
 	ASTWhile(std::unique_ptr<ASTExpression> condition, std::unique_ptr<ASTBody> body);
 
 	Value * codegen() override;
+	void collectEffects(Effects & effects) override;
+	bool markTailCalls(const ASTFunctionPrototype & routine, bool tail) override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	void resolve(Resolver & resolver) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
 private:
 	std::unique_ptr<ASTExpression> condition;
 	std::unique_ptr<ASTBody> body;
@@ -195,12 +306,29 @@ class ASTBreak : public ASTExpression
 {
 public:
 	Value * codegen() override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	void resolve(Resolver & resolver) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
+};
+
+class ASTContinue : public ASTExpression
+{
+public:
+	Value * codegen() override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	void resolve(Resolver & resolver) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
 };
 
 class ASTExit : public ASTExpression
 {
 public:
 	Value * codegen() override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
 };
 
 class ASTReference : public ASTExpression
@@ -209,7 +337,13 @@ public:
 	ASTReference(const std::string & name);
 	virtual Value * codegen() = 0;
 	virtual Value * getAlloca() = 0;
+	// Binds the variable like resolve, but a whole array is allowed
+	virtual void resolveAddress(Resolver & resolver) = 0;
+	// Address of the variable or element in the interpreter
+	virtual int * locate(Interpreter & interpreter) = 0;
 	const std::string name;
+	// Set by resolveAddress
+	VariableSlot slot;
 };
 
 class ASTSingleVarReference: public ASTReference
@@ -218,15 +352,30 @@ public:
 	ASTSingleVarReference(const std::string & name);
 	Value * codegen() override;
 	Value * getAlloca() override;
+	void collectEffects(Effects & effects) override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	void resolve(Resolver & resolver) override;
+	void resolveAddress(Resolver & resolver) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
+	int * locate(Interpreter & interpreter) override;
 };
 
 class ASTArrayReference: public ASTReference
 {
 public:
-	ASTArrayReference(const std::string & name, std::unique_ptr<ASTExpression> idx);
+	ASTArrayReference(const std::string & name, std::unique_ptr<ASTExpression> idx, bool range_checked);
 	Value * codegen() override;
 	Value * getAlloca() override;
+	void collectEffects(Effects & effects) override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	void resolve(Resolver & resolver) override;
+	void resolveAddress(Resolver & resolver) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
+	int * locate(Interpreter & interpreter) override;
 	const std::unique_ptr<ASTExpression> index;
+	const bool range_checked;   // {$R+}
 };
 
 class ASTAssignOp : public ASTExpression
@@ -234,9 +383,17 @@ class ASTAssignOp : public ASTExpression
 public:
 	ASTAssignOp(std::unique_ptr<ASTReference> var, std::unique_ptr<ASTExpression> value);
 	Value * codegen() override;
+	void collectEffects(Effects & effects) override;
+	bool markTailCalls(const ASTFunctionPrototype & routine, bool tail) override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	void resolve(Resolver & resolver) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
 
 	const std::unique_ptr<ASTReference> variable;
 	const std::unique_ptr<ASTExpression> value;
+	// Set by the Resolver: integers copied by the assignment of a whole array, 0 for integers
+	unsigned copied = 0;
 };
 
 
@@ -246,7 +403,20 @@ class ASTBinaryOperator : public ASTExpression
 public:
 	ASTBinaryOperator ( Token op, std::unique_ptr<ASTExpression> LHS, std::unique_ptr<ASTExpression> RHS );
 	Value * codegen() override;
+	bool isBoolean() const override;
+	bool codegenBranch(BasicBlock * if_true, BasicBlock * if_false) override;
+	void collectEffects(Effects & effects) override;
+	int evaluate(ConstantEvaluator & evaluator) override;
+	void resolve(Resolver & resolver) override;
+	int interpret(Interpreter & interpreter) override;
+	int compile(BytecodeCompiler & compiler, int target) override;
+	void compileBranch(BytecodeCompiler & compiler, bool jump_if, unsigned label) override;
 private:
+	bool isComparison() const;
+	// and/or of two booleans, evaluated left to right only as far as needed
+	bool isShortCircuit() const;
+	Value * codegenComparison();
+
 	Token op;
 	std::unique_ptr<ASTExpression> LHS, RHS;
 };
@@ -261,15 +431,60 @@ public:
 		std::unique_ptr<ASTBody> main);
 
 	Value * codegen() override;
-	std::unique_ptr<Module> runCodegen(const std::string & output_file);
+	std::unique_ptr<Module> generateModule(const CompileOptions & options, CompileReport * report = nullptr);
 
 
 	const std::string name;
 	std::vector<std::unique_ptr<ASTVariableDef>> global;
 	std::vector<std::unique_ptr<ASTFunction>> functions;
 	std::unique_ptr<ASTBody> main;
+	// Number of routines declared before each global, constant expressions can only call those
+	std::vector<size_t> routines_before;
+};
+
+// Receives the parts of a program in source order, each one as soon as it is parsed
+class ASTConsumer
+{
+public:
+	virtual ~ASTConsumer () = default;
+	virtual void startProgram(const std::string & name) = 0;
+	virtual void addGlobal(std::unique_ptr<ASTVariableDef> global) = 0;
+	virtual void addFunction(std::unique_ptr<ASTFunction> function) = 0;
+	virtual void finishProgram(std::unique_ptr<ASTBody> main) = 0;
+};
+
+// Generates the IR of every declaration right after it is parsed and frees its AST,
+// so only the routine being compiled is held in memory, never the whole program
+class StreamingCodegen : public ASTConsumer
+{
+public:
+	explicit StreamingCodegen(const CompileOptions & options, CompileReport * report = nullptr);
+
+	void startProgram(const std::string & name) override;
+	void addGlobal(std::unique_ptr<ASTVariableDef> global) override;
+	void addFunction(std::unique_ptr<ASTFunction> function) override;
+	void finishProgram(std::unique_ptr<ASTBody> main) override;
+
+	// The finished module
+	std::unique_ptr<Module> takeModule();
+
+private:
+	const CompileOptions & options;
+	CompileReport * report;
+	BasicBlock * main_block = nullptr;
+	// Pure routines, constant expressions can call them
+	std::vector<std::unique_ptr<ASTFunction>> constant_routines;
 };
 
+/**
+ * Verifies, optimizes and writes the module as requested by options
+ * @param out receives the IR with --print-ir
+ * @param report receives phase times and IR counts, may be null
+ * @throw std::string on failure
+ */
+void emitModule(std::unique_ptr<Module> module, const CompileOptions & options, raw_ostream & out,
+                CompileReport * report = nullptr);
+
 
 
 
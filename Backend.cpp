@@ -0,0 +1,78 @@
+#include "Backend.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetOptions.h"
+
+using namespace llvm;
+
+void initializeTargets()
+{
+	static std::once_flag initialized;
+	std::call_once(initialized, [] {
+		InitializeNativeTarget();
+		InitializeNativeTargetAsmParser();
+		InitializeNativeTargetAsmPrinter();
+	});
+}
+
+/**
+ * Registers every other target, only needed for cross compilation with --target
+ * @return false when the compiler was built with the native target only
+ */
+static bool initializeAllTargets()
+{
+#ifdef PAS_ALL_TARGETS
+	static std::once_flag initialized;
+	std::call_once(initialized, [] {
+		InitializeAllTargetInfos();
+		InitializeAllTargets();
+		InitializeAllTargetMCs();
+		InitializeAllAsmParsers();
+		InitializeAllAsmPrinters();
+	});
+	return true;
+#else
+	return false;
+#endif
+}
+
+TargetMachine * getTargetMachine(const std::string & triple)
+{
+	static thread_local std::map<std::string, std::unique_ptr<TargetMachine>> machines;
+
+	auto & machine = machines[triple];
+	if ( machine )
+		return machine.get();
+
+	initializeTargets();
+
+	std::string Error;
+	auto Target = TargetRegistry::lookupTarget(triple, Error);
+	if ( !Target && initializeAllTargets() )
+		Target = TargetRegistry::lookupTarget(triple, Error);
+
+	// This generally occurs if we've forgotten to initialise the
+	// TargetRegistry or we have a bogus target triple.
+	if (!Target) {
+#ifndef PAS_ALL_TARGETS
+		Error += " (only the native target is built in, configure with -DPAS_ALL_TARGETS=ON)";
+#endif
+		throw Error;
+	}
+
+	// Baseline CPU of the target, not every target knows "generic"
+	auto CPU = "";
+	auto Features = "";
+
+	TargetOptions opt;
+	auto RM = Optional<Reloc::Model>();
+	machine.reset(Target -> createTargetMachine(triple, CPU, Features, opt, RM));
+
+	return machine.get();
+}
@@ -0,0 +1,19 @@
+#ifndef PAS_COMPILER_BACKEND_H
+#define PAS_COMPILER_BACKEND_H
+
+#include <string>
+
+#include "llvm/Target/TargetMachine.h"
+
+// Registers the native code generator with the TargetRegistry, only the first call does any work.
+// Other targets are registered on demand by getTargetMachine.
+void initializeTargets();
+
+/**
+ * Returns a TargetMachine for the triple. Machines are created once per thread and reused
+ * by every later compilation on that thread, a TargetMachine must not be shared between threads.
+ * @throw std::string when the target is not available
+ */
+llvm::TargetMachine * getTargetMachine(const std::string & triple);
+
+#endif //PAS_COMPILER_BACKEND_H
@@ -0,0 +1,331 @@
+#include "Bytecode.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "llvm/Support/Format.h"
+
+// Changes with every change of the instructions or the layout
+static const char magic[8] = {'P', 'A', 'S', 'B', 'C', 0, 0, 2};
+
+static const char * const operand_kinds[] = {
+#define PAS_OPCODE_OPERANDS(name, operands) operands,
+	PAS_OPCODES(PAS_OPCODE_OPERANDS)
+#undef PAS_OPCODE_OPERANDS
+};
+
+static const char * const opcode_names[] = {
+#define PAS_OPCODE_NAME(name, operands) #name,
+	PAS_OPCODES(PAS_OPCODE_NAME)
+#undef PAS_OPCODE_NAME
+};
+
+const char * opcodeOperands(Opcode op)
+{
+	return operand_kinds[(int32_t) op];
+}
+
+const char * opcodeName(Opcode op)
+{
+	return opcode_names[(int32_t) op];
+}
+
+namespace {
+
+// Little endian words, the host order is fine as entries never leave the machine
+class Writer
+{
+public:
+	void word(uint32_t value) { data.append((const char *) &value, sizeof(value)); }
+	void string(const std::string & value)
+	{
+		word(value.size());
+		data += value;
+	}
+	void words(const std::vector<int32_t> & values)
+	{
+		word(values.size());
+		data.append((const char *) values.data(), values.size() * sizeof(int32_t));
+	}
+
+	std::string data;
+};
+
+class Reader
+{
+public:
+	Reader(const std::string & data) : data(data) {}
+
+	bool word(uint32_t & value)
+	{
+		if ( data.size() - position < sizeof(value) )
+			return false;
+		memcpy(&value, data.data() + position, sizeof(value));
+		position += sizeof(value);
+		return true;
+	}
+	bool string(std::string & value)
+	{
+		uint32_t size;
+		if ( !word(size) || data.size() - position < size )
+			return false;
+		value.assign(data, position, size);
+		position += size;
+		return true;
+	}
+	bool words(std::vector<int32_t> & values)
+	{
+		uint32_t size;
+		if ( !word(size) || (data.size() - position) / sizeof(int32_t) < size )
+			return false;
+		values.resize(size);
+		memcpy(values.data(), data.data() + position, size * sizeof(int32_t));
+		position += size * sizeof(int32_t);
+		return true;
+	}
+
+	const std::string & data;
+	size_t position = 0;
+};
+
+}
+
+std::string BytecodeProgram::serialize() const
+{
+	Writer writer;
+	writer.data.assign(magic, sizeof(magic));
+	writer.word(globals);
+	writer.word(strings.size());
+	for ( auto & string : strings )
+		writer.string(string);
+	writer.word(functions.size());
+	for ( auto & function : functions ) {
+		writer.string(function.name);
+		writer.word(function.parameters);
+		writer.word(function.locals);
+		writer.word(function.frame_size);
+		writer.words(function.reference_sizes);
+		writer.word(function.result);
+		writer.words(function.constants);
+		writer.words(function.code);
+	}
+	return writer.data;
+}
+
+bool BytecodeProgram::deserialize(const std::string & data)
+{
+	if ( data.size() < sizeof(magic) || data.compare(0, sizeof(magic), magic, sizeof(magic)) )
+		return false;
+	Reader reader(data);
+	reader.position = sizeof(magic);
+
+	uint32_t count;
+	if ( !reader.word(globals) || !reader.word(count) )
+		return false;
+	strings.clear();
+	for ( uint32_t i = 0; i < count; i++ ) {
+		strings.emplace_back();
+		if ( !reader.string(strings.back()) )
+			return false;
+	}
+	if ( !reader.word(count) )
+		return false;
+	functions.clear();
+	for ( uint32_t i = 0; i < count; i++ ) {
+		functions.emplace_back();
+		BytecodeFunction & function = functions.back();
+		uint32_t result;
+		if ( !reader.string(function.name) || !reader.word(function.parameters) || !reader.word(function.locals)
+		     || !reader.word(function.frame_size) || !reader.words(function.reference_sizes) || !reader.word(result)
+		     || !reader.words(function.constants) || !reader.words(function.code) )
+			return false;
+		function.references = function.reference_sizes.size();
+		function.result = (int32_t) result;
+	}
+	return reader.position == data.size() && validate();
+}
+
+/**
+ * Checks that every operand is within its frame, the globals or the tables, that the code
+ * can't jump or fall outside of its function and that no access leaves the memory it addresses.
+ * The pointers are followed through the straight code between jump targets, where the compiler
+ * always sets them right before their use; a call has to pass every reference of the callee
+ * pointing to at least as many integers as the callee takes.
+ */
+bool BytecodeProgram::validate() const
+{
+	if ( functions.empty() || functions.back().parameters || functions.back().references )
+		return false;
+	uint32_t max_references = 0;
+	for ( auto & function : functions ) {
+		if ( function.references != function.reference_sizes.size() )
+			return false;
+		max_references = std::max(max_references, function.references);
+	}
+
+	for ( auto & function : functions ) {
+		if ( function.parameters > function.locals || function.locals > function.frame_size
+		     || function.frame_size - function.locals < function.constants.size()
+		     || function.result >= (int64_t) function.locals || function.result < -1 )
+			return false;
+
+		// Instruction starts, the only jump targets
+		const std::vector<int32_t> & code = function.code;
+		std::vector<bool> starts(code.size(), false);
+		std::vector<bool> targets(code.size(), false);
+		Opcode last = Opcode::count;
+		for ( size_t pc = 0; pc < code.size(); pc += 1 + strlen(opcodeOperands(last)) ) {
+			if ( code[pc] < 0 || code[pc] >= (int32_t) Opcode::count )
+				return false;
+			starts[pc] = true;
+			last = (Opcode) code[pc];
+			const char * kinds = opcodeOperands(last);
+			if ( pc + 1 + strlen(kinds) > code.size() )
+				return false;
+			for ( size_t i = 0; kinds[i]; i++ )
+				if ( kinds[i] == 'L' && (uint32_t) code[pc + 1 + i] < code.size() )
+					targets[code[pc + 1 + i]] = true;
+		}
+		if ( last != Opcode::halt && last != Opcode::ret && last != Opcode::jmp )
+			return false;
+
+		// Integers the pointer registers can reach and those the references set for the next call can
+		uint64_t extents[2] = {0, 0};
+		std::vector<uint64_t> passed(max_references, 0);
+		for ( size_t pc = 0; pc < code.size(); pc += 1 + strlen(opcodeOperands((Opcode) code[pc])) ) {
+			Opcode op = (Opcode) code[pc];
+			// The main program has no caller to return to
+			if ( op == Opcode::ret && &function == &functions.back() )
+				return false;
+			const char * kinds = opcodeOperands(op);
+			for ( size_t i = 0; kinds[i]; i++ ) {
+				uint32_t operand = code[pc + 1 + i];
+				bool valid = true;
+				switch ( kinds[i] ) {
+					case 'R': valid = operand < function.frame_size; break;
+					case 'L': valid = operand < code.size() && starts[operand]; break;
+					case 'G': valid = operand < globals; break;
+					case 'X': valid = operand < function.references; break;
+					case 'Y': valid = operand < max_references; break;
+					case 'P': valid = operand < 2; break;
+					case 'F': valid = operand < functions.size(); break;
+					case 'S': valid = operand < strings.size(); break;
+					default: break;
+				}
+				if ( !valid )
+					return false;
+			}
+			if ( targets[pc] ) {
+				extents[0] = extents[1] = 0;
+				std::fill(passed.begin(), passed.end(), 0);
+			}
+
+			// Arrays, pointers and copies have to stay within their frame, the globals or what a reference points to
+			auto operand = [&](size_t i) { return (uint64_t) (uint32_t) code[pc + i]; };
+			uint64_t size = operand(strlen(kinds));
+			switch ( op ) {
+				case Opcode::loadel:
+				case Opcode::storeel:
+					if ( operand(2 - (op == Opcode::storeel)) + size > function.locals )
+						return false;
+					break;
+				case Opcode::loadelg:
+				case Opcode::storeelg:
+					if ( operand(2 - (op == Opcode::storeelg)) + size > globals )
+						return false;
+					break;
+				case Opcode::loadelr:
+				case Opcode::storeelr:
+					if ( size > (uint32_t) function.reference_sizes[operand(2 - (op == Opcode::storeelr))] )
+						return false;
+					break;
+				case Opcode::lea:
+					extents[operand(1)] = function.frame_size - operand(2);
+					break;
+				case Opcode::leag:
+					extents[operand(1)] = globals - operand(2);
+					break;
+				case Opcode::lear:
+					extents[operand(1)] = (uint32_t) function.reference_sizes[operand(2)];
+					break;
+				case Opcode::leael:
+					if ( size == 0 || extents[operand(1)] < size )
+						return false;
+					extents[operand(1)] -= size - 1;
+					break;
+				case Opcode::argref:
+					if ( !extents[operand(2)] )
+						return false;
+					passed[operand(1)] = extents[operand(2)];
+					break;
+				case Opcode::argcopy:
+					if ( operand(1) + size > function.frame_size || extents[operand(2)] < size )
+						return false;
+					break;
+				case Opcode::copy:
+					if ( extents[operand(1)] < size || extents[operand(2)] < size )
+						return false;
+					break;
+				case Opcode::read:
+				case Opcode::dec:
+					if ( !extents[operand(1)] )
+						return false;
+					break;
+				case Opcode::call:
+				case Opcode::callv: {
+					const BytecodeFunction & callee = functions[operand(1)];
+					for ( uint32_t i = 0; i < callee.references; i++ )
+						if ( !passed[i] || passed[i] < (uint32_t) callee.reference_sizes[i] )
+							return false;
+					extents[0] = extents[1] = 0;
+					std::fill(passed.begin(), passed.end(), 0);
+					break;
+				}
+				default:
+					break;
+			}
+		}
+	}
+	return true;
+}
+
+void BytecodeProgram::print(llvm::raw_ostream & out) const
+{
+	out << "; " << globals << " globals\n";
+	for ( size_t i = 0; i < strings.size(); i++ )
+		out << "; s" << i << " = \"" << strings[i] << "\"\n";
+
+	for ( size_t f = 0; f < functions.size(); f++ ) {
+		const BytecodeFunction & function = functions[f];
+		out << "\nf" << f << " " << function.name << ": " << function.parameters << " parameters, "
+		    << function.locals << " locals, " << function.frame_size << " registers, "
+		    << function.references << " references";
+		if ( function.result >= 0 )
+			out << ", result r" << function.result;
+		out << "\n";
+		for ( size_t i = 0; i < function.constants.size(); i++ )
+			out << "  r" << function.locals + i << " = " << function.constants[i] << "\n";
+
+		for ( size_t pc = 0; pc < function.code.size(); ) {
+			Opcode op = (Opcode) function.code[pc];
+			const char * kinds = opcodeOperands(op);
+			out << llvm::format("%6u  ", (unsigned) pc) << opcodeName(op);
+			for ( size_t i = 0; kinds[i]; i++ ) {
+				int32_t operand = function.code[pc + 1 + i];
+				out << (i ? ", " : " ");
+				switch ( kinds[i] ) {
+					case 'R': out << "r" << operand; break;
+					case 'G': out << "g" << operand; break;
+					case 'X':
+					case 'Y': out << "x" << operand; break;
+					case 'P': out << "p" << operand; break;
+					case 'F': out << functions[operand].name; break;
+					case 'S': out << "s" << operand; break;
+					default: out << operand; break;
+				}
+			}
+			out << "\n";
+			pc += 1 + strlen(kinds);
+		}
+	}
+}
@@ -0,0 +1,127 @@
+#ifndef PAS_COMPILER_BYTECODE_H
+#define PAS_COMPILER_BYTECODE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/Support/raw_ostream.h"
+
+/**
+ * Instructions of the bytecode VM, X(name, operands) for every opcode.
+ * An instruction is its opcode followed by one 32-bit word per operand:
+ *   R  register of the routine's frame      I  immediate
+ *   L  code offset of a jump target         G  global
+ *   X  reference of the routine's frame     Y  reference of the routine being called
+ *   P  pointer register, 0 or 1             F  function
+ *   S  string
+ * Element accesses take the index register, the lower bound and the size of the array
+ * and always check the index. Comparisons give -1/0 like the generated code.
+ */
+#define PAS_OPCODES(X) \
+	X(halt, "") \
+	X(ret, "") \
+	X(mov, "RR") \
+	X(loadg, "RG") \
+	X(storeg, "GR") \
+	X(loadr, "RX") \
+	X(storer, "XR") \
+	X(loadel, "RRRII") \
+	X(loadelg, "RGRII") \
+	X(loadelr, "RXRII") \
+	X(storeel, "RRRII") \
+	X(storeelg, "GRRII") \
+	X(storeelr, "XRRII") \
+	X(add, "RRR") \
+	X(sub, "RRR") \
+	X(mul, "RRR") \
+	X(div, "RRR") \
+	X(mod, "RRR") \
+	X(bit_and, "RRR") \
+	X(bit_or, "RRR") \
+	X(shl, "RRR") \
+	X(shr, "RRR") \
+	X(eq, "RRR") \
+	X(ne, "RRR") \
+	X(lt, "RRR") \
+	X(le, "RRR") \
+	X(gt, "RRR") \
+	X(ge, "RRR") \
+	X(addi, "RRI") \
+	X(jmp, "L") \
+	X(jz, "RL") \
+	X(jnz, "RL") \
+	X(jeq, "RRL") \
+	X(jne, "RRL") \
+	X(jlt, "RRL") \
+	X(jle, "RRL") \
+	X(jgt, "RRL") \
+	X(jge, "RRL") \
+	X(loop, "RRIL") \
+	X(call, "FRR") \
+	X(callv, "FR") \
+	X(lea, "PR") \
+	X(leag, "PG") \
+	X(lear, "PX") \
+	X(leael, "PRII") \
+	X(argref, "YP") \
+	X(argcopy, "RPI") \
+	X(copy, "PPI") \
+	X(read, "P") \
+	X(dec, "P") \
+	X(writei, "R") \
+	X(writes, "S") \
+	X(writeln, "")
+
+enum class Opcode : int32_t
+{
+#define PAS_OPCODE_ENUM(name, operands) name,
+	PAS_OPCODES(PAS_OPCODE_ENUM)
+#undef PAS_OPCODE_ENUM
+	count
+};
+
+// Operand kinds of an opcode, one letter per operand
+const char * opcodeOperands(Opcode op);
+const char * opcodeName(Opcode op);
+
+/**
+ * A routine compiled to bytecode. Its frame is an array of registers:
+ * the value parameters first, where the caller places them, then the locals and the result,
+ * which start as 0, the constants, loaded on every call, and the temporaries.
+ */
+struct BytecodeFunction
+{
+	std::string name;
+	uint32_t parameters = 0;  // registers of the value parameters
+	uint32_t locals = 0;      // registers of the parameters, locals and the result
+	uint32_t frame_size = 0;
+	uint32_t references = 0;
+	std::vector<int32_t> reference_sizes;  // integers each reference points to
+	int32_t result = -1;      // register of a function's result
+	std::vector<int32_t> constants;
+	std::vector<int32_t> code;
+};
+
+// A whole program compiled to bytecode, the main program is the last function
+struct BytecodeProgram
+{
+	uint32_t globals = 0;
+	std::vector<std::string> strings;
+	std::vector<BytecodeFunction> functions;
+
+	// Binary form for the compile cache
+	std::string serialize() const;
+	/**
+	 * Reads the binary form and checks that the VM can run it
+	 * @return false when data isn't bytecode of this compiler build or is damaged
+	 */
+	bool deserialize(const std::string & data);
+	// Disassembly for --print-ir
+	void print(llvm::raw_ostream & out) const;
+
+private:
+	bool validate() const;
+};
+
+#endif //PAS_COMPILER_BYTECODE_H
@@ -0,0 +1,496 @@
+#include "AbstractSyntaxTree.h"
+#include "BytecodeCompiler.h"
+#include "Effects.h"
+
+#include <algorithm>
+#include <cstring>
+
+BytecodeProgram BytecodeCompiler::compileProgram(ASTProgram & program)
+{
+	resolver.resolveProgram(program);
+
+	BytecodeProgram bytecode;
+	bytecode.globals = resolver.global_size;
+	for ( auto & routine : resolver.routines ) {
+		if ( routine.function ) {
+			bytecode.functions.push_back(compileFunction(routine.name, &routine, *routine.function -> body));
+		} else {
+			// Declared forward and never called
+			BytecodeFunction stub;
+			stub.name = routine.name;
+			stub.code.push_back((int32_t) Opcode::ret);
+			bytecode.functions.push_back(stub);
+		}
+	}
+	bytecode.functions.push_back(compileFunction(program.name, nullptr, *program.main));
+	bytecode.strings = strings;
+	return bytecode;
+}
+
+BytecodeFunction BytecodeCompiler::compileFunction(const std::string & name, const ResolvedRoutine * routine, ASTBody & body)
+{
+	code.clear();
+	constants.clear();
+	constant_registers.clear();
+	labels.clear();
+	loops.clear();
+	current = routine;
+	locals = routine ? routine -> frame_size : 0;
+	top = max_top = locals;
+
+	start_label = newLabel();
+	bind(start_label);
+	exit_label = newLabel();
+	body.compile(*this);
+	bind(exit_label);
+	emit(routine ? Opcode::ret : Opcode::halt, {});
+
+	BytecodeFunction function;
+	function.name = name;
+	if ( routine ) {
+		for ( auto & parameter : routine -> parameters )
+			if ( parameter.slot.kind == VariableSlot::local )
+				function.parameters += parameter.slot.size;
+		function.references = routine -> references;
+		function.reference_sizes.resize(routine -> references);
+		for ( auto & parameter : routine -> parameters )
+			if ( parameter.slot.kind == VariableSlot::reference )
+				function.reference_sizes[parameter.slot.index] = parameter.slot.size;
+		function.result = routine -> result;
+	}
+	function.locals = locals;
+	finishFunction(function);
+	current = nullptr;
+	return function;
+}
+
+void BytecodeCompiler::finishFunction(BytecodeFunction & function)
+{
+	int32_t constant_count = constants.size();
+	for ( size_t pc = 0; pc < code.size(); ) {
+		const char * kinds = opcodeOperands((Opcode) code[pc]);
+		for ( size_t i = 0; kinds[i]; i++ ) {
+			int32_t & operand = code[pc + 1 + i];
+			if ( kinds[i] == 'R' && operand < 0 )
+				operand = locals - operand - 2;
+			else if ( kinds[i] == 'R' && operand >= (int32_t) locals )
+				operand += constant_count;
+			else if ( kinds[i] == 'L' )
+				operand = labels[operand];
+		}
+		pc += 1 + strlen(kinds);
+	}
+	function.frame_size = max_top + constant_count;
+	function.constants = std::move(constants);
+	function.code = std::move(code);
+	constants.clear();
+	code.clear();
+}
+
+void BytecodeCompiler::emit(Opcode op, std::initializer_list<int32_t> operands)
+{
+	code.push_back((int32_t) op);
+	code.insert(code.end(), operands);
+}
+
+int BytecodeCompiler::temporary()
+{
+	max_top = std::max(max_top, top + 1);
+	return top++;
+}
+
+int BytecodeCompiler::constant(int value)
+{
+	auto inserted = constant_registers.emplace(value, -(int) constants.size() - 2);
+	if ( inserted.second )
+		constants.push_back(value);
+	return inserted.first -> second;
+}
+
+int BytecodeCompiler::into(int value, int target)
+{
+	if ( target < 0 || target == value )
+		return value;
+	emit(Opcode::mov, {target, value});
+	return target;
+}
+
+// A local read by an operand is the local's register itself, the generated code would have loaded it before
+int BytecodeCompiler::protect(int value, ASTExpression & expression)
+{
+	if ( value < 0 || value >= (int) locals )
+		return value;
+	Effects effects;
+	expression.collectEffects(effects);
+	if ( effects.calls.empty() && effects.writes.empty() )
+		return value;
+	return into(value, temporary());
+}
+
+unsigned BytecodeCompiler::newLabel()
+{
+	labels.push_back(-1);
+	return labels.size() - 1;
+}
+
+void BytecodeCompiler::bind(unsigned label)
+{
+	labels[label] = code.size();
+}
+
+int BytecodeCompiler::addString(const std::string & value)
+{
+	auto inserted = string_indices.emplace(value, strings.size());
+	if ( inserted.second )
+		strings.push_back(value);
+	return inserted.first -> second;
+}
+
+int BytecodeCompiler::load(const VariableSlot & slot, int target)
+{
+	switch ( slot.kind ) {
+		case VariableSlot::constant:
+			return into(constant(slot.index), target);
+		case VariableSlot::local:
+			return into(slot.index, target);
+		default:
+			break;
+	}
+	int result = target >= 0 ? target : temporary();
+	emit(slot.kind == VariableSlot::global ? Opcode::loadg : Opcode::loadr, {result, slot.index});
+	return result;
+}
+
+void BytecodeCompiler::store(const VariableSlot & slot, int value)
+{
+	switch ( slot.kind ) {
+		case VariableSlot::local:
+			into(value, slot.index);
+			break;
+		case VariableSlot::global:
+			emit(Opcode::storeg, {slot.index, value});
+			break;
+		default:
+			emit(Opcode::storer, {slot.index, value});
+			break;
+	}
+}
+
+int BytecodeCompiler::loadElement(const VariableSlot & slot, int index, int target)
+{
+	static const Opcode opcodes[] = {Opcode::loadel, Opcode::loadelg, Opcode::loadel, Opcode::loadelr};
+	int result = target >= 0 ? target : temporary();
+	emit(opcodes[slot.kind], {result, slot.index, index, slot.lower_bound, (int32_t) slot.size});
+	return result;
+}
+
+void BytecodeCompiler::storeElement(const VariableSlot & slot, int index, int value)
+{
+	static const Opcode opcodes[] = {Opcode::storeel, Opcode::storeelg, Opcode::storeel, Opcode::storeelr};
+	emit(opcodes[slot.kind], {slot.index, index, value, slot.lower_bound, (int32_t) slot.size});
+}
+
+void BytecodeCompiler::address(const VariableSlot & slot, int index, int pointer)
+{
+	static const Opcode opcodes[] = {Opcode::lea, Opcode::leag, Opcode::lea, Opcode::lear};
+	emit(opcodes[slot.kind], {pointer, slot.index});
+	if ( index != -1 )
+		emit(Opcode::leael, {pointer, index, slot.lower_bound, (int32_t) slot.size});
+}
+
+int ASTExpression::compile(BytecodeCompiler &, int)
+{
+	throw std::string("Expression can't be compiled to bytecode");
+}
+
+void ASTExpression::compileBranch(BytecodeCompiler & compiler, bool jump_if, unsigned label)
+{
+	int value = compile(compiler, -1);
+	compiler.emit(jump_if ? Opcode::jnz : Opcode::jz, {value, (int32_t) label});
+}
+
+int ASTNumber::compile(BytecodeCompiler & compiler, int target)
+{
+	return compiler.into(compiler.constant(value), target);
+}
+
+void ASTBody::compile(BytecodeCompiler & compiler)
+{
+	for ( auto & statement : content ) {
+		unsigned mark = compiler.temporaries();
+		statement -> compile(compiler, -1);
+		compiler.releaseTemporaries(mark);
+	}
+}
+
+int ASTIf::compile(BytecodeCompiler & compiler, int)
+{
+	unsigned else_label = compiler.newLabel(), end_label = compiler.newLabel();
+	condition -> compileBranch(compiler, false, else_label);
+	then_body -> compile(compiler);
+	if ( else_body ) {
+		compiler.emit(Opcode::jmp, {(int32_t) end_label});
+		compiler.bind(else_label);
+		else_body -> compile(compiler);
+	} else {
+		compiler.bind(else_label);
+	}
+	compiler.bind(end_label);
+	return -1;
+}
+
+// The bounds are evaluated once and the loop instruction stops at the last value, which can't overflow
+int ASTFor::compile(BytecodeCompiler & compiler, int)
+{
+	int first = compiler.protect(start -> compile(compiler, -1), *end);
+	int last = end -> compile(compiler, compiler.temporary());
+	// A local control variable is stepped in its own register
+	bool local = control.kind == VariableSlot::local;
+	int value = local ? control.index : compiler.temporary();
+
+	unsigned body_label = compiler.newLabel(), next_label = compiler.newLabel(), end_label = compiler.newLabel();
+	compiler.emit(downto ? Opcode::jlt : Opcode::jgt, {first, last, (int32_t) end_label});
+	compiler.into(first, value);
+	compiler.bind(body_label);
+	if ( !local )
+		compiler.store(control, value);
+	compiler.loops.push_back({next_label, end_label});
+	body -> compile(compiler);
+	compiler.loops.pop_back();
+	compiler.bind(next_label);
+	compiler.emit(Opcode::loop, {value, last, downto ? -1 : 1, (int32_t) body_label});
+	compiler.bind(end_label);
+	return -1;
+}
+
+// The condition is at the bottom, one branch per iteration
+int ASTWhile::compile(BytecodeCompiler & compiler, int)
+{
+	unsigned body_label = compiler.newLabel(), condition_label = compiler.newLabel(), end_label = compiler.newLabel();
+	compiler.emit(Opcode::jmp, {(int32_t) condition_label});
+	compiler.bind(body_label);
+	compiler.loops.push_back({condition_label, end_label});
+	body -> compile(compiler);
+	compiler.loops.pop_back();
+	compiler.bind(condition_label);
+	condition -> compileBranch(compiler, true, body_label);
+	compiler.bind(end_label);
+	return -1;
+}
+
+int ASTBreak::compile(BytecodeCompiler & compiler, int)
+{
+	compiler.emit(Opcode::jmp, {(int32_t) compiler.loops.back().end});
+	return -1;
+}
+
+int ASTContinue::compile(BytecodeCompiler & compiler, int)
+{
+	compiler.emit(Opcode::jmp, {(int32_t) compiler.loops.back().next});
+	return -1;
+}
+
+int ASTExit::compile(BytecodeCompiler & compiler, int)
+{
+	compiler.emit(Opcode::jmp, {(int32_t) compiler.exit_label});
+	return -1;
+}
+
+int ASTSingleVarReference::compile(BytecodeCompiler & compiler, int target)
+{
+	return compiler.load(slot, target);
+}
+
+int ASTArrayReference::compile(BytecodeCompiler & compiler, int target)
+{
+	return compiler.loadElement(slot, index -> compile(compiler, -1), target);
+}
+
+// The target's index is computed before the value, as in codegen
+int ASTAssignOp::compile(BytecodeCompiler & compiler, int)
+{
+	if ( copied ) {
+		compiler.address(variable -> slot, -1, 0);
+		compiler.address(static_cast<ASTReference &>(*value).slot, -1, 1);
+		compiler.emit(Opcode::copy, {0, 1, (int32_t) copied});
+		return -1;
+	}
+
+	if ( auto element = dynamic_cast<ASTArrayReference *>(variable.get()) ) {
+		int index = compiler.protect(element -> index -> compile(compiler, -1), *value);
+		compiler.storeElement(variable -> slot, index, value -> compile(compiler, -1));
+	} else if ( variable -> slot.kind == VariableSlot::local ) {
+		// Computed right into the local's register
+		value -> compile(compiler, variable -> slot.index);
+	} else {
+		compiler.store(variable -> slot, value -> compile(compiler, -1));
+	}
+	return -1;
+}
+
+int ASTBinaryOperator::compile(BytecodeCompiler & compiler, int target)
+{
+	if ( isShortCircuit() ) {
+		int result = target >= 0 ? target : compiler.temporary();
+		unsigned false_label = compiler.newLabel(), end_label = compiler.newLabel();
+		compileBranch(compiler, false, false_label);
+		compiler.emit(Opcode::mov, {result, compiler.constant(-1)});
+		compiler.emit(Opcode::jmp, {(int32_t) end_label});
+		compiler.bind(false_label);
+		compiler.emit(Opcode::mov, {result, compiler.constant(0)});
+		compiler.bind(end_label);
+		return result;
+	}
+
+	// Adding or subtracting a number takes an immediate
+	auto number = dynamic_cast<ASTNumber *>(RHS.get());
+	if ( number && (op == tok_plus || op == tok_minus) ) {
+		int left = LHS -> compile(compiler, -1);
+		int result = target >= 0 ? target : compiler.temporary();
+		uint32_t step = op == tok_plus ? (uint32_t) number -> value : 0u - (uint32_t) number -> value;
+		compiler.emit(Opcode::addi, {result, left, (int32_t) step});
+		return result;
+	}
+
+	Opcode opcode;
+	switch ( op ) {
+		case tok_equal: opcode = Opcode::eq; break;
+		case tok_notEqual: opcode = Opcode::ne; break;
+		case tok_less: opcode = Opcode::lt; break;
+		case tok_lessEqual: opcode = Opcode::le; break;
+		case tok_greater: opcode = Opcode::gt; break;
+		case tok_greaterEqual: opcode = Opcode::ge; break;
+		case tok_plus: opcode = Opcode::add; break;
+		case tok_minus: opcode = Opcode::sub; break;
+		case tok_multiply: opcode = Opcode::mul; break;
+		case tok_kwDiv: opcode = Opcode::div; break;
+		case tok_kwMod: opcode = Opcode::mod; break;
+		case tok_kwAnd: opcode = Opcode::bit_and; break;
+		case tok_kwOr: opcode = Opcode::bit_or; break;
+		case tok_kwShl: opcode = Opcode::shl; break;
+		case tok_kwShr: opcode = Opcode::shr; break;
+		default:
+			throw std::string("Unknown binary operator");
+	}
+	int left = compiler.protect(LHS -> compile(compiler, -1), *RHS);
+	int right = RHS -> compile(compiler, -1);
+	int result = target >= 0 ? target : compiler.temporary();
+	compiler.emit(opcode, {result, left, right});
+	return result;
+}
+
+void ASTBinaryOperator::compileBranch(BytecodeCompiler & compiler, bool jump_if, unsigned label)
+{
+	if ( isShortCircuit() ) {
+		// and jumps when either side is false, or when either side is true
+		if ( jump_if == (op == tok_kwOr) ) {
+			LHS -> compileBranch(compiler, jump_if, label);
+			RHS -> compileBranch(compiler, jump_if, label);
+		} else {
+			unsigned decided = compiler.newLabel();
+			LHS -> compileBranch(compiler, !jump_if, decided);
+			RHS -> compileBranch(compiler, jump_if, label);
+			compiler.bind(decided);
+		}
+		return;
+	}
+	if ( !isComparison() ) {
+		ASTExpression::compileBranch(compiler, jump_if, label);
+		return;
+	}
+
+	// Branches on the comparison itself, or on its negation
+	Opcode opcode;
+	switch ( op ) {
+		case tok_equal: opcode = jump_if ? Opcode::jeq : Opcode::jne; break;
+		case tok_notEqual: opcode = jump_if ? Opcode::jne : Opcode::jeq; break;
+		case tok_less: opcode = jump_if ? Opcode::jlt : Opcode::jge; break;
+		case tok_lessEqual: opcode = jump_if ? Opcode::jle : Opcode::jgt; break;
+		case tok_greater: opcode = jump_if ? Opcode::jgt : Opcode::jle; break;
+		default: opcode = jump_if ? Opcode::jge : Opcode::jlt; break;
+	}
+	int left = compiler.protect(LHS -> compile(compiler, -1), *RHS);
+	int right = RHS -> compile(compiler, -1);
+	compiler.emit(opcode, {left, right, (int32_t) label});
+}
+
+int ASTFunctionCall::compile(BytecodeCompiler & compiler, int target)
+{
+	switch ( callee ) {
+		case Callee::writeln:
+		case Callee::write:
+			if ( !arguments.empty() ) {
+				if ( auto string = dynamic_cast<ASTString *>(arguments[0].get()) )
+					compiler.emit(Opcode::writes, {compiler.addString(string -> str)});
+				else
+					compiler.emit(Opcode::writei, {arguments[0] -> compile(compiler, -1)});
+			}
+			if ( callee == Callee::writeln )
+				compiler.emit(Opcode::writeln, {});
+			return compiler.into(compiler.constant(0), target);
+		case Callee::readln:
+		case Callee::dec:
+			if ( !arguments.empty() ) {
+				auto & variable = static_cast<ASTReference &>(*arguments[0]);
+				auto element = dynamic_cast<ASTArrayReference *>(&variable);
+				compiler.address(variable.slot, element ? element -> index -> compile(compiler, -1) : -1, 0);
+				compiler.emit(callee == Callee::readln ? Opcode::read : Opcode::dec, {0});
+			}
+			return compiler.into(compiler.constant(0), target);
+		case Callee::routine:
+			break;
+	}
+
+	const ResolvedRoutine & routine = compiler.routine(routine_index);
+	if ( reuses_frame ) {
+		// All arguments are computed from the old values before any parameter changes
+		std::vector<std::pair<int, int>> moves;
+		for ( size_t i = 0; i < arguments.size(); i++ ) {
+			const ParameterSlot & parameter = routine.parameters[i];
+			if ( parameter.slot.kind == VariableSlot::local && !parameter.copied )
+				moves.emplace_back(parameter.slot.index, arguments[i] -> compile(compiler, compiler.temporary()));
+		}
+		for ( auto & move : moves )
+			compiler.into(move.second, move.first);
+		compiler.emit(Opcode::jmp, {(int32_t) compiler.start_label});
+		return target >= 0 ? target : compiler.constant(0);
+	}
+
+	int result = routine.result >= 0 ? (target >= 0 ? target : compiler.temporary()) : -1;
+	// The value arguments are computed right into the registers of the callee's parameters,
+	// the callee's frame starts at base
+	int base = compiler.temporaries();
+	unsigned parameter_size = 0;
+	for ( auto & parameter : routine.parameters )
+		if ( parameter.slot.kind == VariableSlot::local )
+			parameter_size += parameter.slot.size;
+	for ( unsigned i = 0; i < std::max(parameter_size, 1u); i++ )
+		compiler.temporary();
+
+	// Variables are located after all values are computed, a call among the values would overwrite the references
+	std::vector<int> indices(arguments.size(), -1);
+	for ( size_t i = 0; i < arguments.size(); i++ ) {
+		const ParameterSlot & parameter = routine.parameters[i];
+		if ( parameter.slot.kind == VariableSlot::local && !parameter.copied )
+			arguments[i] -> compile(compiler, base + parameter.slot.index);
+		else if ( auto element = dynamic_cast<ASTArrayReference *>(arguments[i].get()) )
+			indices[i] = element -> index -> compile(compiler, compiler.temporary());
+	}
+	for ( size_t i = 0; i < arguments.size(); i++ ) {
+		const ParameterSlot & parameter = routine.parameters[i];
+		if ( parameter.slot.kind == VariableSlot::local && !parameter.copied )
+			continue;
+		compiler.address(static_cast<ASTReference &>(*arguments[i]).slot, indices[i], 0);
+		if ( parameter.copied )
+			compiler.emit(Opcode::argcopy, {base + parameter.slot.index, 0, (int32_t) parameter.slot.size});
+		else
+			compiler.emit(Opcode::argref, {parameter.slot.index, 0});
+	}
+
+	if ( result >= 0 ) {
+		compiler.emit(Opcode::call, {(int32_t) routine_index, base, result});
+		return result;
+	}
+	compiler.emit(Opcode::callv, {(int32_t) routine_index, base});
+	return compiler.into(compiler.constant(0), target);
+}
@@ -0,0 +1,86 @@
+#ifndef PAS_COMPILER_BYTECODECOMPILER_H
+#define PAS_COMPILER_BYTECODECOMPILER_H
+
+#include <map>
+#include <vector>
+
+#include "Bytecode.h"
+#include "Resolver.h"
+
+class ASTBody;
+class ASTExpression;
+class ASTProgram;
+
+/**
+ * Compiles a resolved program to bytecode for the VM, in a single pass over its AST.
+ * The locals of a routine are its first registers, so reading or assigning a local takes
+ * no instruction of its own; every constant gets a register loaded on entry, and the
+ * temporaries of an expression follow them. Conditions compile to compare-and-branch
+ * instructions and for loops step their control variable with a single loop instruction.
+ */
+class BytecodeCompiler
+{
+public:
+	/**
+	 * Resolves and compiles program
+	 * @throw std::string for errors in the program and what the interpreter doesn't support
+	 */
+	BytecodeProgram compileProgram(ASTProgram & program);
+	// Layout of the compiled program's variables, the bytecode functions are its routines and main
+	const Resolver & resolution() const { return resolver; }
+
+	// Used by ASTExpression::compile
+	void emit(Opcode op, std::initializer_list<int32_t> operands);
+	// Register of a new temporary, live until the end of the statement
+	int temporary();
+	unsigned temporaries() const { return top; }
+	void releaseTemporaries(unsigned mark) { top = mark; }
+	int constant(int value);
+	// Moves value to target unless it is -1 or value itself, @return the register of the value
+	int into(int value, int target);
+	// Copies a variable's register when compiling expression could change the variable
+	int protect(int value, ASTExpression & expression);
+	unsigned newLabel();
+	void bind(unsigned label);
+
+	int load(const VariableSlot & slot, int target);
+	void store(const VariableSlot & slot, int value);
+	int loadElement(const VariableSlot & slot, int index, int target);
+	void storeElement(const VariableSlot & slot, int index, int value);
+	// Points pointer register to the variable or the element at register index, -1 for a whole array
+	void address(const VariableSlot & slot, int index, int pointer);
+
+	const ResolvedRoutine & routine(unsigned index) const { return resolver.routines[index]; }
+	// The routine being compiled, null in the main program
+	const ResolvedRoutine * current = nullptr;
+	// Labels of the enclosing loops for break and continue, of the routine's end for exit
+	struct Loop
+	{
+		unsigned next, end;
+	};
+	std::vector<Loop> loops;
+	unsigned exit_label = 0;
+	// Label of the start of the routine, where self calls in tail position jump
+	unsigned start_label = 0;
+	// Index of a string written by the program
+	int addString(const std::string & value);
+
+private:
+	BytecodeFunction compileFunction(const std::string & name, const ResolvedRoutine * routine, ASTBody & body);
+	// Numbers the constants and temporaries and fills in the jump targets
+	void finishFunction(BytecodeFunction & function);
+
+	Resolver resolver;
+	std::vector<std::string> strings;
+	std::map<std::string, int> string_indices;
+
+	// Of the function being compiled: locals, then temporaries numbered from locals until
+	// finishFunction places the constants between them, constant k is register -k-2 meanwhile
+	std::vector<int32_t> code;
+	unsigned locals = 0, top = 0, max_top = 0;
+	std::map<int, int> constant_registers;
+	std::vector<int32_t> constants;
+	std::vector<int32_t> labels;
+};
+
+#endif //PAS_COMPILER_BYTECODECOMPILER_H
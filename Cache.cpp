@@ -0,0 +1,158 @@
+#include "Cache.h"
+
+#include <chrono>
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+// Any address inside the executable, used to locate it
+static void executableAnchor() {}
+
+// Copies a file including its permissions, cached executables have to stay executable
+static std::error_code copyFile(const std::string & from, const Twine & to)
+{
+	auto permissions = sys::fs::getPermissions(from);
+	if ( !permissions )
+		return permissions.getError();
+	if ( std::error_code EC = sys::fs::copy_file(from, to) )
+		return EC;
+	return sys::fs::setPermissions(to, *permissions);
+}
+
+// Marks an entry as recently used for the LRU eviction
+static void touchEntry(const std::string & entry)
+{
+	int fd;
+	if ( !sys::fs::openFileForRead(entry, fd) ) {
+		sys::fs::setLastModificationAndAccessTime(fd, std::chrono::system_clock::now());
+		sys::Process::SafelyCloseFileDescriptor(fd);
+	}
+}
+
+CompileCache::CompileCache(const std::string & directory, uint64_t max_size)
+	: directory(directory), max_size(max_size) {}
+
+// The pruner only considers files with the "llvmcache-" prefix
+std::string CompileCache::entryPath(const std::string & key) const
+{
+	return directory + "/llvmcache-" + key;
+}
+
+std::string CompileCache::computeKey(const CompileOptions & options) const
+{
+	auto source = MemoryBuffer::getFile(options.input_file);
+	if ( !source )
+		return "";
+
+	MD5 hash;
+	auto add = [&hash](StringRef field) {
+		hash.update(field);
+		hash.update(ArrayRef<uint8_t>((const uint8_t *) "", 1));
+	};
+
+	// Compiler build, any rebuild of the executable invalidates the cache
+	add("pas_compiler " PAS_COMPILER_VERSION " llvm " LLVM_VERSION_STRING);
+	sys::fs::file_status executable;
+	if ( !sys::fs::status(sys::fs::getMainExecutable(nullptr, (void *) &executableAnchor), executable) ) {
+		add(std::to_string(executable.getSize()));
+		add(std::to_string(executable.getLastModificationTime().time_since_epoch().count()));
+	}
+
+	// Everything influencing the output, keep in sync with CompileOptions
+	add(options.target_triple);
+	add(std::to_string(options.opt_level));
+	add(std::to_string(options.stack_array_limit));
+	add(options.range_checks ? "range-checks" : "no-range-checks");
+	add(std::to_string(options.emit));
+	add(options.executable ? "exe" : "no-exe");
+	add(options.vm ? "bytecode" : "native");
+
+	hash.update((*source) -> getBuffer());
+
+	MD5::MD5Result result;
+	hash.final(result);
+	return result.digest().str().str();
+}
+
+/**
+ * Places a cached output at output_file, hard linked when possible
+ * @return true on a cache hit
+ */
+bool CompileCache::fetch(const std::string & key, const std::string & output_file)
+{
+	std::string entry = entryPath(key);
+	if ( !sys::fs::exists(entry) )
+		return false;
+
+	sys::fs::remove(output_file);
+	// The entry may be evicted by a concurrent prune at any point, that is just a miss
+	if ( sys::fs::create_hard_link(entry, output_file) && copyFile(entry, output_file) )
+		return false;
+
+	touchEntry(entry);
+	return true;
+}
+
+/**
+ * Copies a freshly compiled output into the cache and evicts old entries if needed
+ */
+void CompileCache::store(const std::string & key, const std::string & output_file)
+{
+	insert(key, [&](const Twine & temp_path) { return copyFile(output_file, temp_path); });
+}
+
+/**
+ * Reads a cached output into contents
+ * @return true on a cache hit
+ */
+bool CompileCache::load(const std::string & key, std::string & contents)
+{
+	std::string entry = entryPath(key);
+	auto buffer = MemoryBuffer::getFile(entry);
+	if ( !buffer )
+		return false;
+	contents = (*buffer) -> getBuffer().str();
+	touchEntry(entry);
+	return true;
+}
+
+void CompileCache::save(const std::string & key, const std::string & contents)
+{
+	insert(key, [&](const Twine & temp_path) {
+		std::error_code EC;
+		raw_fd_ostream file(temp_path.str(), EC, sys::fs::F_None);
+		if ( EC )
+			return EC;
+		file << contents;
+		file.close();
+		return file.error();
+	});
+}
+
+void CompileCache::insert(const std::string & key, function_ref<std::error_code(const Twine &)> write)
+{
+	if ( sys::fs::create_directories(directory) )
+		return;
+
+	// Write under a private name and publish it atomically
+	SmallString<128> temp_path;
+	if ( sys::fs::createUniqueFile(directory + "/llvmcache.tmp-%%%%%%%%", temp_path) )
+		return;
+	if ( write(temp_path) || sys::fs::rename(temp_path, entryPath(key)) ) {
+		sys::fs::remove(temp_path);
+		return;
+	}
+
+	CachePruningPolicy policy;
+	policy.Interval = std::chrono::seconds(60);
+	policy.Expiration = std::chrono::hours(30 * 24);
+	policy.MaxSizeBytes = max_size;
+	pruneCache(directory, policy);
+}
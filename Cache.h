@@ -0,0 +1,42 @@
+#ifndef PAS_COMPILER_CACHE_H
+#define PAS_COMPILER_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Twine.h"
+
+#include "Options.h"
+
+/**
+ * Local content-addressed cache of compiler outputs.
+ * An entry is keyed by the hash of the source bytes, the compiler build and every option
+ * affecting the output. Entries are published by an atomic rename, so parallel invocations
+ * never see a partially written file, and the directory is kept under max_size by evicting
+ * the least recently used entries.
+ */
+class CompileCache
+{
+public:
+	CompileCache(const std::string & directory, uint64_t max_size);
+
+	// Empty when the source file can't be read
+	std::string computeKey(const CompileOptions & options) const;
+
+	bool fetch(const std::string & key, const std::string & output_file);
+	void store(const std::string & key, const std::string & output_file);
+	// The same for outputs kept in memory, like the bytecode of --vm
+	bool load(const std::string & key, std::string & contents);
+	void save(const std::string & key, const std::string & contents);
+
+private:
+	std::string entryPath(const std::string & key) const;
+	// Publishes the entry written by write to a temporary file
+	void insert(const std::string & key, llvm::function_ref<std::error_code(const llvm::Twine &)> write);
+
+	std::string directory;
+	uint64_t max_size;
+};
+
+#endif //PAS_COMPILER_CACHE_H
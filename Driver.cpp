@@ -0,0 +1,226 @@
+#include "Driver.h"
+
+#include "Pipeline.h"
+#include "JIT.h"
+#include "Interpreter.h"
+#include "BytecodeCompiler.h"
+#include "VirtualMachine.h"
+#include "Tiered.h"
+#include "Cache.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <mutex>
+
+using namespace llvm;
+
+static void printReport(const CompileOptions & options, const CompileReport & report, raw_ostream & out)
+{
+	if ( options.report_json ) {
+		report.printJSON(out, options.time_report, options.stats);
+		return;
+	}
+	if ( options.time_report )
+		report.printTimes(out);
+	if ( options.stats )
+		report.printStats(out);
+}
+
+int compileProgram(const CompileOptions & options, raw_ostream & out)
+{
+	const std::string & input_file = options.input_file;
+	TraceScope scope("compile", input_file);
+
+	// A cache hit skips the whole compilation
+	std::unique_ptr<CompileCache> cache;
+	std::string cache_key;
+	if ( !options.cache_dir.empty() && !options.jit && !options.interpret && !options.tiered ) {
+		cache = std::make_unique<CompileCache>(options.cache_dir, options.cache_max_size);
+		cache_key = cache -> computeKey(options);
+		BytecodeProgram bytecode;
+		std::string contents;
+		if ( options.vm && !cache_key.empty() && cache -> load(cache_key, contents) && bytecode.deserialize(contents) ) {
+			if ( options.print_ir )
+				bytecode.print(out);
+			out.flush();
+			return VirtualMachine(bytecode).run();
+		}
+		if ( !options.vm && !cache_key.empty() && cache -> fetch(cache_key, options.output_file) ) {
+			out << "Wrote " << options.output_file << " (cached)\n";
+			return 0;
+		}
+	}
+
+	std::unique_ptr<CompileReport> report;
+	if ( options.time_report || options.stats ) {
+		report = std::make_unique<CompileReport>();
+		report -> file = input_file;
+	}
+
+	// Printed before the program runs or an error is reported
+	std::vector<std::string> warnings;
+	auto printWarnings = [&] {
+		for ( auto & warning : warnings )
+			out << "Warning in " << input_file << ": " << warning << "\n";
+		warnings.clear();
+	};
+
+	try {
+		auto parse_start = CompileReport::now();
+		auto measured_start = report ? report -> measured() : parse_start;
+		std::unique_ptr<ASTProgram> parsed_program;
+		std::unique_ptr<Module> module;
+		{
+			// Lexing runs interleaved with parsing, the trace shows both as one phase
+			TraceScope parse_scope("phase", "Parsing");
+			if ( options.pipeline ) {
+				module = generatePipelined(options, report.get(), warnings);
+			} else {
+				// The pipeline opens the input in its own lexer
+				Parser parser(input_file);
+				parser.setReport(report.get());
+				parser.setRangeChecks(options.range_checks);
+				parser.setWarnings(&warnings);
+				if ( options.streaming ) {
+					StreamingCodegen generator(options, report.get());
+					parser.parse(generator);
+					module = generator.takeModule();
+				} else {
+					parsed_program = parser.start();
+				}
+			}
+		}
+		printWarnings();
+		if ( report && !options.pipeline ) {
+			// Lexing (and streamed IR generation) was measured separately, while the parser was running
+			auto parse_end = CompileReport::now();
+			auto measured_end = report -> measured();
+			report -> addTime("Parsing", parse_end.wall - parse_start.wall - (measured_end.wall - measured_start.wall),
+			                  parse_end.cpu - parse_start.cpu - (measured_end.cpu - measured_start.cpu));
+			report -> notePeakMemory("Parsing");
+		}
+
+		// The interpreter runs the syntax tree, nothing of LLVM is initialized
+		if ( options.interpret ) {
+			Interpreter interpreter;
+			{
+				PhaseTimer timer(report.get(), "Name resolution");
+				interpreter.load(*parsed_program);
+			}
+			if ( report )
+				printReport(options, *report, out);
+			out.flush();
+			return interpreter.run();
+		}
+
+		// The VM runs the bytecode, which is cached like the outputs of LLVM
+		if ( options.vm ) {
+			BytecodeProgram bytecode;
+			{
+				PhaseTimer timer(report.get(), "Bytecode compilation");
+				bytecode = BytecodeCompiler().compileProgram(*parsed_program);
+			}
+			parsed_program.reset();
+			if ( cache && !cache_key.empty() )
+				cache -> save(cache_key, bytecode.serialize());
+			if ( options.print_ir )
+				bytecode.print(out);
+			if ( report )
+				printReport(options, *report, out);
+			out.flush();
+			return VirtualMachine(bytecode).run();
+		}
+
+		// Starts like --vm, the syntax tree is kept for generating the code of hot routines
+		if ( options.tiered ) {
+			BytecodeCompiler compiler;
+			BytecodeProgram bytecode;
+			{
+				PhaseTimer timer(report.get(), "Bytecode compilation");
+				bytecode = compiler.compileProgram(*parsed_program);
+			}
+			if ( options.print_ir )
+				bytecode.print(out);
+			if ( report )
+				printReport(options, *report, out);
+			out.flush();
+			return TieredExecution(*parsed_program, compiler.resolution(), bytecode, options).run();
+		}
+
+		if ( parsed_program ) {
+			module = parsed_program -> generateModule(options, report.get());
+			// The IR is all that is needed from here on
+			parsed_program.reset();
+		}
+
+		if ( options.jit ) {
+			if ( !module )
+				throw "Code generation failed";
+			if ( report ) {
+				report -> countIR(*module);
+				printReport(options, *report, out);
+			}
+			out.flush();
+
+			// The IR is printed once the JIT has optimized it
+			PascalJIT jit(std::move(module), options.opt_level, options.lazy_jit, options.print_ir ? &out : nullptr);
+			return jit.run();
+		}
+
+		emitModule(std::move(module), options, out, report.get());
+		out << "Wrote " << options.output_file << "\n";
+		if ( report )
+			printReport(options, *report, out);
+
+		if ( cache && !cache_key.empty() )
+			cache -> store(cache_key, options.output_file);
+
+	} catch (const char * exception) {
+		printWarnings();
+		out << "Error while compiling " << input_file << "\n";
+		out << exception << "\n";
+		return 2;
+	} catch (const std::string & exception) {
+		printWarnings();
+		out << "Error while compiling " << input_file << "\n";
+		out << exception << "\n";
+		return 2;
+	}
+
+	return 0;
+}
+
+int compileInputs(const CompileOptions & options, raw_ostream & out)
+{
+	if ( options.input_files.size() == 1 )
+		return compileProgram(options, out);
+
+	std::mutex output_mutex;
+	int exit_code = 0;
+	{
+		// Workers keep their code generation context and target machine for all their inputs
+		WorkerPool pool(std::min<size_t>(options.jobs ? options.jobs : std::thread::hardware_concurrency(),
+		                                 options.input_files.size()));
+
+		for ( auto & input_file : options.input_files ) {
+			pool.async([&, input_file] {
+				CompileOptions single = options;
+				single.input_file = input_file;
+				single.output_file = outputFileFor(options, input_file);
+
+				std::string messages;
+				raw_string_ostream message_stream(messages);
+				int code = compileProgram(single, message_stream);
+				message_stream.flush();
+
+				std::lock_guard<std::mutex> lock(output_mutex);
+				out << messages;
+				exit_code = std::max(exit_code, code);
+			});
+		}
+	}
+	out.flush();
+
+	return exit_code;
+}
@@ -0,0 +1,23 @@
+#ifndef PAS_COMPILER_DRIVER_H
+#define PAS_COMPILER_DRIVER_H
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "Options.h"
+
+/**
+ * Compiles one program as requested by options, or runs it with --jit.
+ * Safe to call from several threads at once, each call uses the code generation state of its thread.
+ * @param out receives the messages normally printed to stdout
+ * @return process exit code, 0 on success
+ */
+int compileProgram(const CompileOptions & options, llvm::raw_ostream & out);
+
+/**
+ * Compiles every input of options, several inputs in parallel on options.jobs threads.
+ * The messages of one input are written together once it is done.
+ * @return the highest exit code of the inputs
+ */
+int compileInputs(const CompileOptions & options, llvm::raw_ostream & out);
+
+#endif //PAS_COMPILER_DRIVER_H
@@ -0,0 +1,329 @@
+#include "AbstractSyntaxTree.h"
+#include "Effects.h"
+
+#include <algorithm>
+
+const char * purityName(Purity purity)
+{
+	switch ( purity ) {
+		case Purity::pure:
+			return "pure";
+		case Purity::reads_globals:
+			return "reading globals";
+		case Purity::side_effects:
+			return "with side effects";
+	}
+	return "";
+}
+
+bool RoutineEffects::operator == (const RoutineEffects & other) const
+{
+	return purity == other.purity && globals_read == other.globals_read && globals_written == other.globals_written
+	       && io == other.io && written_parameters == other.written_parameters && read_parameters == other.read_parameters;
+}
+
+// Parts of loops and branches may not run, only the conditions are evaluated every time
+class ConditionalScope
+{
+public:
+	ConditionalScope(Effects & effects) : effects(effects), conditional(effects.conditional) { effects.conditional = true; }
+	~ConditionalScope() { effects.conditional = conditional; }
+private:
+	Effects & effects;
+	bool conditional;
+};
+
+void ASTBody::collectEffects(Effects & effects)
+{
+	for ( auto & statement : content )
+		statement -> collectEffects(effects);
+}
+
+void ASTIf::collectEffects(Effects & effects)
+{
+	condition -> collectEffects(effects);
+
+	ConditionalScope scope(effects);
+	then_body -> collectEffects(effects);
+	if ( else_body )
+		else_body -> collectEffects(effects);
+}
+
+void ASTFor::collectEffects(Effects & effects)
+{
+	start -> collectEffects(effects);
+	end -> collectEffects(effects);
+	effects.writes.insert(variable_name);
+
+	ConditionalScope scope(effects);
+	body -> collectEffects(effects);
+}
+
+void ASTWhile::collectEffects(Effects & effects)
+{
+	condition -> collectEffects(effects);
+
+	ConditionalScope scope(effects);
+	body -> collectEffects(effects);
+}
+
+void ASTSingleVarReference::collectEffects(Effects & effects)
+{
+	effects.reads.insert(name);
+}
+
+void ASTArrayReference::collectEffects(Effects & effects)
+{
+	effects.reads.insert(name);
+	index -> collectEffects(effects);
+}
+
+void ASTAssignOp::collectEffects(Effects & effects)
+{
+	value -> collectEffects(effects);
+	effects.writes.insert(variable -> name);
+	if ( auto element = dynamic_cast<ASTArrayReference *>(variable.get()) )
+		element -> index -> collectEffects(effects);
+}
+
+void ASTBinaryOperator::collectEffects(Effects & effects)
+{
+	LHS -> collectEffects(effects);
+	if ( !isShortCircuit() ) {
+		RHS -> collectEffects(effects);
+		return;
+	}
+
+	ConditionalScope scope(effects);
+	RHS -> collectEffects(effects);
+}
+
+void ASTFunctionCall::collectEffects(Effects & effects)
+{
+	CallSite call{name, {}};
+	for ( auto & argument : arguments ) {
+		argument -> collectEffects(effects);
+		auto variable = dynamic_cast<ASTReference *>(argument.get());
+		call.arguments.push_back(variable ? variable -> name : "");
+	}
+
+	if ( name == "writeln" || name == "write" ) {
+		effects.io = true;
+	} else if ( name == "readln" || name == "dec" ) {
+		effects.io |= name == "readln";
+		if ( !call.arguments.empty() && !call.arguments[0].empty() )
+			effects.writes.insert(call.arguments[0]);
+	} else {
+		effects.calls.push_back(call);
+		if ( !effects.conditional )
+			effects.unconditional_calls.push_back(this);
+	}
+}
+
+void EffectAnalysis::addRoutine(ASTFunction & function)
+{
+	Routine & routine = routines[function.getName()];
+	routine.parameters.clear();
+	routine.var_parameters.clear();
+	for ( auto & parameter : function.prototype -> parameters ) {
+		routine.parameters.push_back(parameter -> name);
+		routine.var_parameters.push_back(parameter -> mode == ASTParameter::var);
+	}
+	if ( !function.body )
+		return;
+
+	routine.locals.insert(routine.parameters.begin(), routine.parameters.end());
+	for ( auto & local : function.local_variables )
+		routine.locals.insert(local -> name);
+	routine.locals.insert(function.getName());
+
+	function.body -> collectEffects(routine.effects);
+	routine.defined = true;
+}
+
+RoutineEffects EffectAnalysis::resolveCalls(Effects & effects) const
+{
+	RoutineEffects callees;
+	for ( const CallSite & call : effects.calls ) {
+		const RoutineEffects * callee = find(call.routine);
+		if ( !callee ) {
+			effects.unknown_calls = true;
+			callees.purity = Purity::side_effects;
+			continue;
+		}
+
+		callees.io |= callee -> io;
+		callees.globals_read.insert(callee -> globals_read.begin(), callee -> globals_read.end());
+		callees.globals_written.insert(callee -> globals_written.begin(), callee -> globals_written.end());
+		for ( size_t i = 0; i < call.arguments.size() && i < callee -> written_parameters.size(); i++ )
+			if ( callee -> written_parameters[i] && !call.arguments[i].empty() )
+				effects.writes.insert(call.arguments[i]);
+	}
+
+	if ( callees.io || !callees.globals_written.empty() )
+		callees.purity = Purity::side_effects;
+	else if ( !callees.globals_read.empty() )
+		callees.purity = std::max(callees.purity, Purity::reads_globals);
+	return callees;
+}
+
+RoutineEffects EffectAnalysis::transfer(const Routine & routine) const
+{
+	Effects effects = routine.effects;
+	RoutineEffects summary = resolveCalls(effects);
+	summary.io |= effects.io;
+
+	// Anything not declared in the routine is global, constants aren't variables
+	for ( auto & name : effects.reads )
+		if ( !routine.locals.count(name) && globals.count(name) )
+			summary.globals_read.insert(name);
+	for ( auto & name : effects.writes )
+		if ( !routine.locals.count(name) && globals.count(name) )
+			summary.globals_written.insert(name);
+
+	bool reads_parameters = false;
+	summary.written_parameters.assign(routine.parameters.size(), false);
+	summary.read_parameters.assign(routine.parameters.size(), false);
+	for ( size_t i = 0; i < routine.parameters.size(); i++ ) {
+		summary.read_parameters[i] = effects.reads.count(routine.parameters[i]) > 0;
+		if ( !routine.var_parameters[i] )
+			continue;
+		summary.written_parameters[i] = effects.writes.count(routine.parameters[i]) > 0;
+		reads_parameters |= effects.reads.count(routine.parameters[i]) > 0;
+	}
+
+	bool writes_parameters = std::find(summary.written_parameters.begin(), summary.written_parameters.end(), true)
+	                         != summary.written_parameters.end();
+	if ( summary.io || !summary.globals_written.empty() || writes_parameters )
+		summary.purity = Purity::side_effects;
+	else if ( reads_parameters || !summary.globals_read.empty() )
+		summary.purity = std::max(summary.purity, Purity::reads_globals);
+	return summary;
+}
+
+// Where the iteration starts, the routine does nothing yet
+RoutineEffects EffectAnalysis::pureSummary(const Routine & routine)
+{
+	RoutineEffects summary;
+	summary.written_parameters.assign(routine.parameters.size(), false);
+	summary.read_parameters.assign(routine.parameters.size(), false);
+	return summary;
+}
+
+/**
+ * Solves the summaries of all routines added so far. Starting from pure routines and only
+ * adding effects, the iteration ends with the least solution, so recursion keeps routines pure.
+ */
+void EffectAnalysis::analyze()
+{
+	for ( auto & routine : routines ) {
+		routine.second.summarized = routine.second.defined;
+		routine.second.summary = pureSummary(routine.second);
+	}
+
+	bool changed = true;
+	while ( changed ) {
+		changed = false;
+		for ( auto & routine : routines ) {
+			if ( !routine.second.defined )
+				continue;
+			RoutineEffects summary = transfer(routine.second);
+			if ( summary != routine.second.summary ) {
+				routine.second.summary = std::move(summary);
+				changed = true;
+			}
+		}
+	}
+}
+
+// The same iteration for one routine, calls of itself are the only ones not yet summarized
+void EffectAnalysis::summarize(const std::string & name)
+{
+	auto it = routines.find(name);
+	if ( it == routines.end() || !it -> second.defined )
+		return;
+
+	Routine & routine = it -> second;
+	routine.summarized = true;
+	routine.summary = pureSummary(routine);
+	while ( true ) {
+		RoutineEffects summary = transfer(routine);
+		if ( summary == routine.summary )
+			break;
+		routine.summary = std::move(summary);
+	}
+}
+
+const RoutineEffects * EffectAnalysis::find(const std::string & routine) const
+{
+	auto it = routines.find(routine);
+	if ( it == routines.end() || !it -> second.summarized )
+		return nullptr;
+	return &it -> second.summary;
+}
+
+std::map<Purity, unsigned> EffectAnalysis::countRoutines() const
+{
+	std::map<Purity, unsigned> counts;
+	for ( auto & routine : routines )
+		if ( routine.second.summarized )
+			counts[routine.second.summary.purity]++;
+	return counts;
+}
+
+bool EffectAnalysis::isInvariant(ASTFunctionCall & call, const std::set<std::string> & loop_writes) const
+{
+	const RoutineEffects * callee = find(call.name);
+	if ( !callee || callee -> purity == Purity::side_effects )
+		return false;
+
+	Effects effects;
+	for ( size_t i = 0; i < call.arguments.size(); i++ ) {
+		// A variable passed for an unused parameter doesn't change the result
+		bool unused = i < callee -> read_parameters.size() && !callee -> read_parameters[i];
+		if ( unused && dynamic_cast<ASTSingleVarReference *>(call.arguments[i].get()) )
+			continue;
+		call.arguments[i] -> collectEffects(effects);
+	}
+	RoutineEffects callees = resolveCalls(effects);
+	if ( callees.purity == Purity::side_effects || effects.io || !effects.writes.empty() )
+		return false;
+
+	for ( auto & name : effects.reads )
+		if ( loop_writes.count(name) )
+			return false;
+	for ( auto & name : callee -> globals_read )
+		if ( loop_writes.count(name) )
+			return false;
+	for ( auto & name : callees.globals_read )
+		if ( loop_writes.count(name) )
+			return false;
+	return true;
+}
+
+void EffectAnalysis::addAliases(const std::string & name, std::set<std::string> & writes) const
+{
+	auto it = routines.find(name);
+	if ( it == routines.end() )
+		return;
+	const Routine & routine = it -> second;
+
+	bool var_written = false, global_written = false;
+	for ( size_t i = 0; i < routine.parameters.size(); i++ )
+		var_written |= routine.var_parameters[i] && writes.count(routine.parameters[i]);
+	for ( auto & global : globals )
+		global_written |= writes.count(global) > 0;
+
+	if ( var_written || global_written )
+		for ( size_t i = 0; i < routine.parameters.size(); i++ )
+			if ( routine.var_parameters[i] )
+				writes.insert(routine.parameters[i]);
+	if ( var_written )
+		writes.insert(globals.begin(), globals.end());
+}
+
+void EffectAnalysis::clear()
+{
+	globals.clear();
+	routines.clear();
+}
@@ -0,0 +1,120 @@
+#ifndef PAS_COMPILER_EFFECTS_H
+#define PAS_COMPILER_EFFECTS_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class ASTFunction;
+class ASTFunctionCall;
+
+// What a routine does besides computing its result, from the least to the most
+enum class Purity
+{
+	pure,           // depends on its value arguments only
+	reads_globals,  // also reads global variables or var parameters
+	side_effects,   // writes globals or var parameters, does input or output
+};
+
+const char * purityName(Purity purity);
+
+// Call of a routine of the program found in an expression
+struct CallSite
+{
+	std::string routine;
+	// Variable passed as each argument, empty for other expressions
+	std::vector<std::string> arguments;
+};
+
+/**
+ * Variables an expression or statement uses, filled by ASTExpression::collectEffects.
+ * Names are as written in the source, so a local shadowing a global is the same name.
+ */
+struct Effects
+{
+	std::set<std::string> reads, writes;
+	std::vector<CallSite> calls;
+	bool io = false;            // write, writeln, readln
+	bool unknown_calls = false; // set by EffectAnalysis::resolveCalls
+
+	// Calls made every time the expression is evaluated, callees after their arguments
+	std::vector<ASTFunctionCall *> unconditional_calls;
+	// Set while collecting the right side of a short-circuit and/or
+	bool conditional = false;
+};
+
+// Summary of a routine and of everything it calls
+struct RoutineEffects
+{
+	Purity purity = Purity::pure;
+	std::set<std::string> globals_read, globals_written;
+	bool io = false;
+	// var parameters the routine assigns, the caller's arguments are written by a call
+	std::vector<bool> written_parameters;
+	// Parameters the result may depend on
+	std::vector<bool> read_parameters;
+
+	bool operator == (const RoutineEffects & other) const;
+	bool operator != (const RoutineEffects & other) const { return !(*this == other); }
+};
+
+/**
+ * Interprocedural side effect analysis of the routines of a program.
+ * Routines are added in source order. analyze() solves the whole call graph, recursion included,
+ * while summarize() judges the routine just added by the routines seen before it, which is what
+ * a streaming compilation can do. Calls of routines without a summary are side effects.
+ */
+class EffectAnalysis
+{
+public:
+	void addGlobal(const std::string & name) { globals.insert(name); }
+	// Forward declarations only record the parameters
+	void addRoutine(ASTFunction & function);
+	void analyze();
+	void summarize(const std::string & routine);
+
+	// Null when the routine isn't summarized yet
+	const RoutineEffects * find(const std::string & routine) const;
+	std::map<Purity, unsigned> countRoutines() const;
+
+	/**
+	 * Includes the effects of the calls in effects, as seen by the caller
+	 * @return the effects of the callees, side effects when one of them is unknown
+	 */
+	RoutineEffects resolveCalls(Effects & effects) const;
+	/**
+	 * Whether call gives the same result each time it is evaluated in a loop that writes
+	 * the variables in loop_writes and the call itself has no side effects
+	 */
+	bool isInvariant(ASTFunctionCall & call, const std::set<std::string> & loop_writes) const;
+	/**
+	 * Adds the variables that writes may change through aliasing inside routine: a var parameter
+	 * may be bound to any global or to another var parameter. Writing a global or a var parameter
+	 * counts as writing every var parameter, and writing a var parameter as writing every global.
+	 */
+	void addAliases(const std::string & routine, std::set<std::string> & writes) const;
+
+	void clear();
+
+private:
+	struct Routine
+	{
+		std::vector<std::string> parameters;
+		std::vector<bool> var_parameters;
+		std::set<std::string> locals;  // parameters, local variables and the result
+		Effects effects;
+		bool defined = false;
+		bool summarized = false;
+		RoutineEffects summary;
+	};
+
+	static RoutineEffects pureSummary(const Routine & routine);
+	// Summary of routine by its body and the current summaries of its callees
+	RoutineEffects transfer(const Routine & routine) const;
+
+	std::set<std::string> globals;
+	std::map<std::string, Routine> routines;
+};
+
+#endif //PAS_COMPILER_EFFECTS_H
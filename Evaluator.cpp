@@ -0,0 +1,408 @@
+#include "AbstractSyntaxTree.h"
+#include "Evaluator.h"
+
+#include <climits>
+
+// Limits keeping the compiler responsive, routines beyond them run at run time
+static const uint64_t max_steps = 1 << 22;
+static const unsigned max_depth = 200;
+static const size_t max_array_size = 1 << 20;
+
+// Integer arithmetic wraps around like the generated code
+static int wrap(uint32_t value)
+{
+	return (int) value;
+}
+
+void ConstantEvaluator::addRoutine(ASTFunction & routine)
+{
+	if ( routine.body )
+		routines[routine.getName()] = &routine;
+}
+
+int ConstantEvaluator::evaluate(ASTExpression & expression)
+{
+	frame = nullptr;
+	depth = 0;
+	steps = 0;
+	flow = Flow::normal;
+	return expression.evaluate(*this);
+}
+
+int ConstantEvaluator::require(ASTExpression & expression, const std::string & what)
+{
+	try {
+		return evaluate(expression);
+	} catch ( NotConstant & error ) {
+		throw what + " is not a constant expression: " + error.reason;
+	}
+}
+
+void ConstantEvaluator::resolveBounds(ASTArray & array)
+{
+	array.lower = require(*array.lowerIdx, "Array bound");
+	array.upper = require(*array.upperIdx, "Array bound");
+	if ( array.upper < array.lower )
+		throw "Array bounds " + std::to_string(array.lower) + ".." + std::to_string(array.upper) + " are empty";
+}
+
+void ConstantEvaluator::step()
+{
+	if ( ++steps > max_steps )
+		throw NotConstant{"evaluation takes too long"};
+}
+
+void ConstantEvaluator::allocate(uint64_t elements)
+{
+	steps += elements;
+	if ( steps > max_steps )
+		throw NotConstant{"evaluation takes too much memory"};
+}
+
+EvaluatedVariable & ConstantEvaluator::variable(const std::string & name)
+{
+	if ( frame ) {
+		auto reference = frame -> references.find(name);
+		if ( reference != frame -> references.end() )
+			return *reference -> second;
+		auto variable = frame -> variables.find(name);
+		if ( variable != frame -> variables.end() )
+			return variable -> second;
+	}
+	throw NotConstant{"variable " + name + " has no value at compile time"};
+}
+
+// Constants are found first, as in the generated code
+int ConstantEvaluator::value(const std::string & name)
+{
+	auto constant = constants.find(name);
+	if ( constant != constants.end() )
+		return constant -> second;
+
+	EvaluatedVariable & variable = this -> variable(name);
+	if ( variable.array )
+		throw NotConstant{"array " + name + " used as a number"};
+	return variable.values[0];
+}
+
+EvaluatedVariable ConstantEvaluator::createVariable(ASTVariableType & type)
+{
+	EvaluatedVariable variable;
+	auto array = dynamic_cast<ASTArray *>(&type);
+	if ( !array ) {
+		variable.values.assign(1, 0);
+		return variable;
+	}
+
+	if ( dynamic_cast<ASTArray *>(array -> type.get()) )
+		throw NotConstant{"arrays of arrays aren't evaluated"};
+	int lower = array -> lowerIdx -> evaluate(*this);
+	int upper = array -> upperIdx -> evaluate(*this);
+	if ( upper < lower || (uint64_t) ((int64_t) upper - lower + 1) > max_array_size )
+		throw NotConstant{"array too large"};
+	allocate(upper - lower + 1);
+
+	variable.values.assign(upper - lower + 1, 0);
+	variable.lower_bound = lower;
+	variable.array = true;
+	return variable;
+}
+
+/**
+ * Runs routine with the arguments evaluated in the current frame. Calls with integer value
+ * parameters only are remembered, a routine without side effects gives the same result again.
+ * @return the result, 0 for procedures
+ */
+int ConstantEvaluator::call(const std::string & name, std::vector<std::unique_ptr<ASTExpression>> & arguments)
+{
+	auto routine_it = routines.find(name);
+	if ( routine_it == routines.end() )
+		throw NotConstant{"routine " + name + " can't be run at compile time"};
+	ASTFunction & routine = *routine_it -> second;
+	ASTFunctionPrototype & prototype = *routine.prototype;
+	if ( arguments.size() != prototype.parameters.size() )
+		throw NotConstant{"wrong number of arguments of " + name};
+	if ( depth >= max_depth )
+		throw NotConstant{"recursion too deep"};
+
+	Frame callee;
+	std::pair<std::string, std::vector<int>> key(name, {});
+	bool remembered = true;
+	for ( size_t i = 0; i < arguments.size(); i++ ) {
+		ASTParameter & parameter = *prototype.parameters[i];
+		bool array = dynamic_cast<ASTArray *>(parameter.type.get()) != nullptr;
+		if ( parameter.mode == ASTParameter::value && !array ) {
+			int value = arguments[i] -> evaluate(*this);
+			callee.variables[parameter.name].values.assign(1, value);
+			key.second.push_back(value);
+			continue;
+		}
+
+		// Arrays and var and const parameters are variables of the caller
+		remembered = false;
+		auto reference = dynamic_cast<ASTSingleVarReference *>(arguments[i].get());
+		if ( !reference )
+			throw NotConstant{"argument of " + name + " isn't a variable"};
+		EvaluatedVariable & argument = variable(reference -> name);
+		if ( parameter.mode == ASTParameter::value ) {
+			allocate(argument.values.size());
+			callee.variables[parameter.name] = argument;
+		}
+		else
+			callee.references[parameter.name] = &argument;
+	}
+
+	if ( remembered ) {
+		auto result = results.find(key);
+		if ( result != results.end() )
+			return result -> second;
+		if ( depth == 0 && failed_calls.count(key) )
+			throw NotConstant{"call of " + name + " can't be evaluated"};
+	}
+
+	for ( auto & local : routine.local_variables )
+		callee.variables[local -> name] = createVariable(*local -> type);
+	if ( prototype.returnType )
+		callee.variables[name] = createVariable(*prototype.returnType);
+
+	Frame * caller = frame;
+	frame = &callee;
+	depth++;
+	try {
+		routine.body -> evaluate(*this);
+	} catch ( NotConstant & ) {
+		frame = caller;
+		depth--;
+		flow = Flow::normal;
+		// Other calls may fail for lack of the steps spent before them
+		if ( remembered && depth == 0 )
+			failed_calls.insert(key);
+		throw;
+	}
+	frame = caller;
+	depth--;
+	flow = Flow::normal;
+
+	int result = 0;
+	if ( prototype.returnType ) {
+		EvaluatedVariable & value = callee.variables[name];
+		if ( value.array )
+			throw NotConstant{"array result of " + name};
+		result = value.values[0];
+	}
+	if ( remembered )
+		results[key] = result;
+	return result;
+}
+
+void ConstantEvaluator::clear()
+{
+	constants.clear();
+	routines.clear();
+	results.clear();
+	failed_calls.clear();
+	frame = nullptr;
+	depth = 0;
+	flow = Flow::normal;
+}
+
+int ASTExpression::evaluate(ConstantEvaluator &)
+{
+	throw NotConstant{"expression has no value at compile time"};
+}
+
+int ASTNumber::evaluate(ConstantEvaluator &)
+{
+	return value;
+}
+
+int ASTBody::evaluate(ConstantEvaluator & evaluator)
+{
+	for ( auto & statement : content ) {
+		evaluator.step();
+		statement -> evaluate(evaluator);
+		if ( evaluator.flow != ConstantEvaluator::Flow::normal )
+			break;
+	}
+	return 0;
+}
+
+int ASTIf::evaluate(ConstantEvaluator & evaluator)
+{
+	if ( condition -> evaluate(evaluator) )
+		return then_body -> evaluate(evaluator);
+	if ( else_body )
+		return else_body -> evaluate(evaluator);
+	return 0;
+}
+
+// Ends the loop after break and exit, returns whether the loop goes on
+static bool continueLoop(ConstantEvaluator & evaluator)
+{
+	switch ( evaluator.flow ) {
+		case ConstantEvaluator::Flow::break_loop:
+			evaluator.flow = ConstantEvaluator::Flow::normal;
+			return false;
+		case ConstantEvaluator::Flow::continue_loop:
+			evaluator.flow = ConstantEvaluator::Flow::normal;
+			return true;
+		case ConstantEvaluator::Flow::exit_routine:
+			return false;
+		default:
+			return true;
+	}
+}
+
+// The control variable steps from start to end, both evaluated once
+int ASTFor::evaluate(ConstantEvaluator & evaluator)
+{
+	int first = start -> evaluate(evaluator);
+	int last = end -> evaluate(evaluator);
+	EvaluatedVariable & control = evaluator.variable(variable_name);
+	if ( control.array )
+		throw NotConstant{"array " + variable_name + " used as a control variable"};
+	if ( downto ? first < last : first > last )
+		return 0;
+
+	for ( int value = first; ; downto ? value-- : value++ ) {
+		evaluator.step();
+		control.values[0] = value;
+		body -> evaluate(evaluator);
+		if ( !continueLoop(evaluator) || value == last )
+			break;
+	}
+	return 0;
+}
+
+int ASTWhile::evaluate(ConstantEvaluator & evaluator)
+{
+	while ( true ) {
+		evaluator.step();
+		if ( !condition -> evaluate(evaluator) )
+			break;
+		body -> evaluate(evaluator);
+		if ( !continueLoop(evaluator) )
+			break;
+	}
+	return 0;
+}
+
+int ASTBreak::evaluate(ConstantEvaluator & evaluator)
+{
+	evaluator.flow = ConstantEvaluator::Flow::break_loop;
+	return 0;
+}
+
+int ASTContinue::evaluate(ConstantEvaluator & evaluator)
+{
+	evaluator.flow = ConstantEvaluator::Flow::continue_loop;
+	return 0;
+}
+
+int ASTExit::evaluate(ConstantEvaluator & evaluator)
+{
+	evaluator.flow = ConstantEvaluator::Flow::exit_routine;
+	return 0;
+}
+
+int ASTSingleVarReference::evaluate(ConstantEvaluator & evaluator)
+{
+	return evaluator.value(name);
+}
+
+// Element of an array variable, an index out of bounds is left to run time
+static int & element(EvaluatedVariable & variable, const std::string & name, int index)
+{
+	if ( !variable.array )
+		throw NotConstant{name + " is not an array"};
+	int64_t offset = (int64_t) index - variable.lower_bound;
+	if ( offset < 0 || offset >= (int64_t) variable.values.size() )
+		throw NotConstant{"index out of bounds of " + name};
+	return variable.values[offset];
+}
+
+int ASTArrayReference::evaluate(ConstantEvaluator & evaluator)
+{
+	EvaluatedVariable & variable = evaluator.variable(name);
+	return element(variable, name, index -> evaluate(evaluator));
+}
+
+int ASTAssignOp::evaluate(ConstantEvaluator & evaluator)
+{
+	int new_value = value -> evaluate(evaluator);
+	EvaluatedVariable & target = evaluator.variable(variable -> name);
+	if ( auto array_reference = dynamic_cast<ASTArrayReference *>(variable.get()) ) {
+		element(target, variable -> name, array_reference -> index -> evaluate(evaluator)) = new_value;
+		return 0;
+	}
+	if ( target.array )
+		throw NotConstant{"array " + variable -> name + " assigned as a number"};
+	target.values[0] = new_value;
+	return 0;
+}
+
+int ASTBinaryOperator::evaluate(ConstantEvaluator & evaluator)
+{
+	if ( isShortCircuit() ) {
+		bool left = LHS -> evaluate(evaluator) != 0;
+		if ( op == tok_kwAnd ? left : !left )
+			left = RHS -> evaluate(evaluator) != 0;
+		return left ? -1 : 0;
+	}
+
+	int left = LHS -> evaluate(evaluator);
+	int right = RHS -> evaluate(evaluator);
+	switch ( op ) {
+		case tok_equal:
+			return left == right ? -1 : 0;
+		case tok_notEqual:
+			return left != right ? -1 : 0;
+		case tok_less:
+			return left < right ? -1 : 0;
+		case tok_lessEqual:
+			return left <= right ? -1 : 0;
+		case tok_greater:
+			return left > right ? -1 : 0;
+		case tok_greaterEqual:
+			return left >= right ? -1 : 0;
+		case tok_plus:
+			return wrap((uint32_t) left + (uint32_t) right);
+		case tok_minus:
+			return wrap((uint32_t) left - (uint32_t) right);
+		case tok_multiply:
+			return wrap((uint32_t) left * (uint32_t) right);
+		case tok_kwDiv:
+		case tok_kwMod:
+			if ( right == 0 || (left == INT_MIN && right == -1) )
+				throw NotConstant{"division by zero or overflow"};
+			return op == tok_kwDiv ? left / right : left % right;
+		case tok_kwAnd:
+			return left & right;
+		case tok_kwOr:
+			return left | right;
+		case tok_kwShl:
+			return wrap((uint32_t) left << (right & 31));
+		case tok_kwShr:
+			return wrap((uint32_t) left >> (right & 31));
+		default:
+			throw NotConstant{"unknown operator"};
+	}
+}
+
+int ASTFunctionCall::evaluate(ConstantEvaluator & evaluator)
+{
+	if ( name == "dec" ) {
+		auto reference = arguments.empty() ? nullptr : dynamic_cast<ASTSingleVarReference *>(arguments[0].get());
+		if ( !reference )
+			throw NotConstant{"dec of an expression"};
+		EvaluatedVariable & variable = evaluator.variable(reference -> name);
+		if ( variable.array )
+			throw NotConstant{"dec of array " + reference -> name};
+		variable.values[0] = wrap((uint32_t) variable.values[0] - 1);
+		return 0;
+	}
+	if ( name == "writeln" || name == "write" || name == "readln" )
+		throw NotConstant{"input and output happen at run time"};
+
+	return evaluator.call(name, arguments);
+}
@@ -0,0 +1,94 @@
+#ifndef PAS_COMPILER_EVALUATOR_H
+#define PAS_COMPILER_EVALUATOR_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+class ASTArray;
+class ASTExpression;
+class ASTFunction;
+class ASTVariableType;
+
+// Thrown when an expression has no value at compile time
+struct NotConstant
+{
+	std::string reason;
+};
+
+// Variable of a routine run at compile time, an integer is an array of one element
+struct EvaluatedVariable
+{
+	std::vector<int> values;
+	int lower_bound = 0;
+	bool array = false;
+};
+
+/**
+ * Evaluates constant expressions at compile time, including calls of routines without side
+ * effects. Routines run on their own variables; reading or writing anything else, input and
+ * output, errors like a division by zero or an index out of bounds and running too long all
+ * make the expression not constant, so it is left to run time.
+ */
+class ConstantEvaluator
+{
+public:
+	enum class Flow { normal, break_loop, continue_loop, exit_routine };
+
+	void addConstant(const std::string & name, int value) { constants[name] = value; }
+	// Routines declared from now on can be called
+	void addRoutine(ASTFunction & routine);
+
+	/**
+	 * @return the value of expression
+	 * @throw NotConstant
+	 */
+	int evaluate(ASTExpression & expression);
+	/**
+	 * Value of an expression that has to be constant
+	 * @throw std::string saying why what is not a constant expression
+	 */
+	int require(ASTExpression & expression, const std::string & what);
+	// Evaluates the bounds of array, @throw std::string when they aren't constant or are empty
+	void resolveBounds(ASTArray & array);
+
+	void clear();
+
+	// Used by ASTExpression::evaluate
+	EvaluatedVariable & variable(const std::string & name);
+	int value(const std::string & name);
+	int call(const std::string & routine, std::vector<std::unique_ptr<ASTExpression>> & arguments);
+	// Counts a statement or loop iteration against the budget
+	void step();
+
+	Flow flow = Flow::normal;
+
+private:
+	// Variables of a routine being run
+	struct Frame
+	{
+		std::map<std::string, EvaluatedVariable> variables;
+		// var and const parameters, the caller's variables
+		std::map<std::string, EvaluatedVariable *> references;
+	};
+
+	EvaluatedVariable createVariable(ASTVariableType & type);
+	// Counts the integers of a new array against the budget, which bounds the memory used too
+	void allocate(uint64_t elements);
+
+	std::map<std::string, int> constants;
+	std::map<std::string, ASTFunction *> routines;
+	// Results of calls with the same arguments
+	std::map<std::pair<std::string, std::vector<int>>, int> results;
+	// Calls evaluate() already failed on
+	std::set<std::pair<std::string, std::vector<int>>> failed_calls;
+
+	Frame * frame = nullptr;
+	unsigned depth = 0;
+	uint64_t steps = 0;
+};
+
+#endif //PAS_COMPILER_EVALUATOR_H
@@ -0,0 +1,347 @@
+#include "AbstractSyntaxTree.h"
+#include "Interpreter.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+
+#include "llvm/Support/Threading.h"
+
+// The interpreter recurses with the program, on a stack large enough for the deepest calls allowed
+static const unsigned stack_size = 512 << 20;
+static const unsigned max_depth = 200000;
+// Frames up to this many integers are kept on the stack
+static const unsigned small_frame = 32;
+
+void Interpreter::load(ASTProgram & program)
+{
+	resolver.resolveProgram(program);
+	main = program.main.get();
+}
+
+int Interpreter::run()
+{
+	globals.assign(resolver.global_size, 0);
+	llvm_execute_on_thread([](void * interpreter) { static_cast<Interpreter *>(interpreter) -> runMain(); },
+	                       this, stack_size);
+	return exit_code;
+}
+
+void Interpreter::runMain()
+{
+	try {
+		flow = Flow::normal;
+		main -> interpret(*this);
+		exit_code = 0;
+	} catch ( ProgramExit & exit ) {
+		exit_code = exit.code;
+	}
+}
+
+// Same message and exit code as the range checks of the generated code, on stderr after the output written so far
+void Interpreter::rangeError(int index)
+{
+	fflush(stdout);
+	fprintf(stderr, "Range check error: index %d out of bounds\n", index);
+	throw ProgramExit{201};
+}
+
+void Interpreter::divisionByZero()
+{
+	fflush(stdout);
+	fprintf(stderr, "Division by zero\n");
+	throw ProgramExit{200};
+}
+
+/**
+ * Runs routine with the arguments evaluated in the current frame
+ * @return the result, 0 for procedures
+ */
+int Interpreter::call(unsigned index, std::vector<std::unique_ptr<ASTExpression>> & arguments)
+{
+	const ResolvedRoutine & routine = resolver.routines[index];
+	if ( depth >= max_depth ) {
+		fflush(stdout);
+		fprintf(stderr, "Stack overflow\n");
+		throw ProgramExit{202};
+	}
+
+	int small_values[small_frame];
+	int * small_references[small_frame];
+	std::unique_ptr<int[]> large_values;
+	std::unique_ptr<int *[]> large_references;
+	Frame callee = {small_values, small_references};
+	if ( routine.frame_size > small_frame ) {
+		large_values.reset(new int[routine.frame_size]);
+		callee.values = large_values.get();
+	}
+	if ( routine.references > small_frame ) {
+		large_references.reset(new int *[routine.references]);
+		callee.references = large_references.get();
+	}
+	std::fill_n(callee.values, routine.frame_size, 0);
+
+	for ( size_t i = 0; i < arguments.size(); i++ ) {
+		const VariableSlot & parameter = routine.parameters[i].slot;
+		if ( parameter.kind == VariableSlot::reference )
+			callee.references[parameter.index] = static_cast<ASTReference &>(*arguments[i]).locate(*this);
+		else if ( routine.parameters[i].copied )
+			std::copy_n(static_cast<ASTReference &>(*arguments[i]).locate(*this), parameter.size, callee.values + parameter.index);
+		else
+			callee.values[parameter.index] = arguments[i] -> interpret(*this);
+	}
+
+	Frame * caller = frame;
+	frame = &callee;
+	depth++;
+	ASTBody & body = *routine.function -> body;
+	do {
+		flow = Flow::normal;
+		body.interpret(*this);
+	} while ( flow == Flow::tail_call );
+	flow = Flow::normal;
+	frame = caller;
+	depth--;
+
+	return routine.result >= 0 ? callee.values[routine.result] : 0;
+}
+
+void Interpreter::restart(unsigned index, std::vector<std::unique_ptr<ASTExpression>> & arguments)
+{
+	const ResolvedRoutine & routine = resolver.routines[index];
+
+	// All arguments are evaluated with the old values, the others are the same variables again
+	std::vector<int> values;
+	for ( size_t i = 0; i < arguments.size(); i++ )
+		if ( routine.parameters[i].slot.kind == VariableSlot::local && !routine.parameters[i].copied )
+			values.push_back(arguments[i] -> interpret(*this));
+
+	auto value = values.begin();
+	for ( auto & parameter : routine.parameters )
+		if ( parameter.slot.kind == VariableSlot::local && !parameter.copied )
+			frame -> values[parameter.slot.index] = *value++;
+	flow = Flow::tail_call;
+}
+
+int ASTExpression::interpret(Interpreter &)
+{
+	throw std::string("Expression can't be interpreted");
+}
+
+int ASTNumber::interpret(Interpreter &)
+{
+	return value;
+}
+
+int ASTBody::interpret(Interpreter & interpreter)
+{
+	for ( auto & statement : content ) {
+		statement -> interpret(interpreter);
+		if ( interpreter.flow != Interpreter::Flow::normal )
+			break;
+	}
+	return 0;
+}
+
+int ASTIf::interpret(Interpreter & interpreter)
+{
+	if ( condition -> interpret(interpreter) )
+		return then_body -> interpret(interpreter);
+	if ( else_body )
+		return else_body -> interpret(interpreter);
+	return 0;
+}
+
+// Ends the loop after break, exit and tail calls, returns whether the loop goes on
+static bool continueLoop(Interpreter & interpreter)
+{
+	switch ( interpreter.flow ) {
+		case Interpreter::Flow::normal:
+			return true;
+		case Interpreter::Flow::continue_loop:
+			interpreter.flow = Interpreter::Flow::normal;
+			return true;
+		case Interpreter::Flow::break_loop:
+			interpreter.flow = Interpreter::Flow::normal;
+			return false;
+		default:
+			return false;
+	}
+}
+
+// Bounds are evaluated once, the control variable never steps past the end
+int ASTFor::interpret(Interpreter & interpreter)
+{
+	int first = start -> interpret(interpreter);
+	int last = end -> interpret(interpreter);
+	if ( downto ? first < last : first > last )
+		return 0;
+
+	int * variable = interpreter.address(control);
+	for ( int value = first; ; downto ? value-- : value++ ) {
+		*variable = value;
+		body -> interpret(interpreter);
+		if ( !continueLoop(interpreter) || value == last )
+			break;
+	}
+	return 0;
+}
+
+int ASTWhile::interpret(Interpreter & interpreter)
+{
+	while ( condition -> interpret(interpreter) ) {
+		body -> interpret(interpreter);
+		if ( !continueLoop(interpreter) )
+			break;
+	}
+	return 0;
+}
+
+int ASTBreak::interpret(Interpreter & interpreter)
+{
+	interpreter.flow = Interpreter::Flow::break_loop;
+	return 0;
+}
+
+int ASTContinue::interpret(Interpreter & interpreter)
+{
+	interpreter.flow = Interpreter::Flow::continue_loop;
+	return 0;
+}
+
+int ASTExit::interpret(Interpreter & interpreter)
+{
+	interpreter.flow = Interpreter::Flow::exit_routine;
+	return 0;
+}
+
+int ASTSingleVarReference::interpret(Interpreter & interpreter)
+{
+	if ( slot.kind == VariableSlot::constant )
+		return slot.index;
+	return *interpreter.address(slot);
+}
+
+int * ASTSingleVarReference::locate(Interpreter & interpreter)
+{
+	return interpreter.address(slot);
+}
+
+int ASTArrayReference::interpret(Interpreter & interpreter)
+{
+	return *locate(interpreter);
+}
+
+// Indices are always checked, the interpreter must not touch memory outside of the array
+int * ASTArrayReference::locate(Interpreter & interpreter)
+{
+	int * array = interpreter.address(slot);
+	int value = index -> interpret(interpreter);
+	uint32_t offset = (uint32_t) value - (uint32_t) slot.lower_bound;
+	if ( offset >= slot.size )
+		interpreter.rangeError(value);
+	return array + offset;
+}
+
+// The target is located before the value is computed, as in codegen
+int ASTAssignOp::interpret(Interpreter & interpreter)
+{
+	int * target = variable -> locate(interpreter);
+	if ( copied ) {
+		int * source = static_cast<ASTReference &>(*value).locate(interpreter);
+		std::copy_n(source, copied, target);
+		return 0;
+	}
+
+	int new_value = value -> interpret(interpreter);
+	// A tail call jumps away before its result is stored
+	if ( interpreter.flow == Interpreter::Flow::normal )
+		*target = new_value;
+	return 0;
+}
+
+int ASTBinaryOperator::interpret(Interpreter & interpreter)
+{
+	if ( isShortCircuit() ) {
+		bool left = LHS -> interpret(interpreter) != 0;
+		if ( op == tok_kwAnd ? left : !left )
+			left = RHS -> interpret(interpreter) != 0;
+		return left ? -1 : 0;
+	}
+
+	int left = LHS -> interpret(interpreter);
+	int right = RHS -> interpret(interpreter);
+	switch ( op ) {
+		case tok_equal:
+			return left == right ? -1 : 0;
+		case tok_notEqual:
+			return left != right ? -1 : 0;
+		case tok_less:
+			return left < right ? -1 : 0;
+		case tok_lessEqual:
+			return left <= right ? -1 : 0;
+		case tok_greater:
+			return left > right ? -1 : 0;
+		case tok_greaterEqual:
+			return left >= right ? -1 : 0;
+		case tok_plus:
+			return (int) ((uint32_t) left + (uint32_t) right);
+		case tok_minus:
+			return (int) ((uint32_t) left - (uint32_t) right);
+		case tok_multiply:
+			return (int) ((uint32_t) left * (uint32_t) right);
+		case tok_kwDiv:
+		case tok_kwMod:
+			if ( right == 0 )
+				interpreter.divisionByZero();
+			// The only overflow wraps around
+			if ( left == INT_MIN && right == -1 )
+				return op == tok_kwDiv ? INT_MIN : 0;
+			return op == tok_kwDiv ? left / right : left % right;
+		case tok_kwAnd:
+			return left & right;
+		case tok_kwOr:
+			return left | right;
+		case tok_kwShl:
+			return (int) ((uint32_t) left << (right & 31));
+		case tok_kwShr:
+			return (int) ((uint32_t) left >> (right & 31));
+		default:
+			return 0;
+	}
+}
+
+int ASTFunctionCall::interpret(Interpreter & interpreter)
+{
+	switch ( callee ) {
+		case Callee::writeln:
+		case Callee::write:
+			if ( !arguments.empty() ) {
+				if ( auto string = dynamic_cast<ASTString *>(arguments[0].get()) )
+					printf("%s", string -> str.c_str());
+				else
+					printf("%d", arguments[0] -> interpret(interpreter));
+			}
+			if ( callee == Callee::writeln )
+				printf("\n");
+			return 0;
+		case Callee::readln:
+			if ( !arguments.empty() )
+				scanf("%d", static_cast<ASTReference &>(*arguments[0]).locate(interpreter));
+			return 0;
+		case Callee::dec:
+			if ( !arguments.empty() ) {
+				int * variable = static_cast<ASTReference &>(*arguments[0]).locate(interpreter);
+				*variable = (int) ((uint32_t) *variable - 1);
+			}
+			return 0;
+		case Callee::routine:
+			break;
+	}
+
+	if ( reuses_frame ) {
+		interpreter.restart(routine_index, arguments);
+		return 0;
+	}
+	return interpreter.call(routine_index, arguments);
+}
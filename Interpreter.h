@@ -0,0 +1,77 @@
+#ifndef PAS_COMPILER_INTERPRETER_H
+#define PAS_COMPILER_INTERPRETER_H
+
+#include <memory>
+#include <vector>
+
+#include "Resolver.h"
+
+class ASTBody;
+class ASTExpression;
+class ASTProgram;
+class CompileReport;
+
+// Thrown to end the interpreted program, like exit in the generated code
+struct ProgramExit
+{
+	int code;
+};
+
+/**
+ * Runs a program directly on its AST, without LLVM, for --interpret.
+ * The Resolver binds every name to a slot first: globals are one array, each call gets
+ * a frame of integers for its value parameters, locals and result and the addresses of
+ * the variables passed by reference. The output is the same as of the generated code;
+ * runtime errors end the program with the Turbo Pascal exit codes.
+ */
+class Interpreter
+{
+public:
+	enum class Flow { normal, break_loop, continue_loop, exit_routine, tail_call };
+
+	/**
+	 * Resolves program, which has to outlive the interpreter
+	 * @throw std::string when the program can't be run
+	 */
+	void load(ASTProgram & program);
+	// Runs the main program on a thread with a large stack, @return the exit code
+	int run();
+
+	// Used by ASTExpression::interpret
+	int * address(const VariableSlot & slot)
+	{
+		switch ( slot.kind ) {
+			case VariableSlot::global:
+				return globals.data() + slot.index;
+			case VariableSlot::local:
+				return frame -> values + slot.index;
+			default:
+				return frame -> references[slot.index];
+		}
+	}
+	int call(unsigned routine, std::vector<std::unique_ptr<ASTExpression>> & arguments);
+	// Self call in tail position, sets the parameters and restarts the routine being run
+	void restart(unsigned routine, std::vector<std::unique_ptr<ASTExpression>> & arguments);
+	[[noreturn]] void rangeError(int index);
+	[[noreturn]] void divisionByZero();
+
+	Flow flow = Flow::normal;
+
+private:
+	struct Frame
+	{
+		int * values;
+		int ** references;
+	};
+
+	void runMain();
+
+	Resolver resolver;
+	ASTBody * main = nullptr;
+	std::vector<int> globals;
+	Frame * frame = nullptr;
+	unsigned depth = 0;
+	int exit_code = 0;
+};
+
+#endif //PAS_COMPILER_INTERPRETER_H
@@ -0,0 +1,339 @@
+#include "JIT.h"
+
+#include <algorithm>
+
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include "Optimizer.h"
+#include "Trace.h"
+
+using namespace llvm;
+
+// Called by the stubs, returns the address of the freshly compiled routine
+static void * compileCallback(PascalJIT * jit, int id)
+{
+	return jit -> compileFunction(id);
+}
+
+// Calls of a routine reach its stub, which writes the routine's address slot and calls the compiler.
+// What codegen inferred about the routine's memory accesses and recursion doesn't hold for it.
+static void removeStubbedAttributes(Function & function)
+{
+	for ( auto kind : {Attribute::ReadNone, Attribute::ReadOnly, Attribute::WriteOnly, Attribute::ArgMemOnly,
+	                   Attribute::NoRecurse} )
+		function.removeFnAttr(kind);
+}
+
+/// Creates declarations of the base module globals inside an extracted function module.
+/// Private constants (string literals) can't be shared across modules, so they are copied.
+class DeclarationMaterializer : public ValueMaterializer
+{
+public:
+	DeclarationMaterializer(Module & source, Module & destination) : source(source), destination(destination) {}
+
+	Value * materialize(Value * value) override
+	{
+		auto global = dyn_cast<GlobalValue>(value);
+		if ( !global || global -> getParent() != &source )
+			return nullptr;
+
+		if ( auto function = dyn_cast<Function>(global) ) {
+			Function * declaration = Function::Create(function -> getFunctionType(), GlobalValue::ExternalLinkage,
+			                                          function -> getName(), &destination);
+			declaration -> setCallingConv(function -> getCallingConv());
+			declaration -> setAttributes(function -> getAttributes());
+			removeStubbedAttributes(*declaration);
+			return declaration;
+		}
+
+		auto variable = cast<GlobalVariable>(global);
+		if ( variable -> hasLocalLinkage() ) {
+			auto copy = new GlobalVariable(destination, variable -> getValueType(), variable -> isConstant(),
+			                               variable -> getLinkage(), variable -> getInitializer(), variable -> getName());
+			copy -> setUnnamedAddr(variable -> getUnnamedAddr());
+			return copy;
+		}
+		return new GlobalVariable(destination, variable -> getValueType(), variable -> isConstant(),
+		                          GlobalValue::ExternalLinkage, nullptr, variable -> getName());
+	}
+
+private:
+	Module & source;
+	Module & destination;
+};
+
+static CodeGenOpt::Level codegenOptLevel(unsigned opt_level)
+{
+	switch ( opt_level ) {
+		case 0:
+			return CodeGenOpt::None;
+		case 1:
+			return CodeGenOpt::Less;
+		case 2:
+			return CodeGenOpt::Default;
+		default:
+			return CodeGenOpt::Aggressive;
+	}
+}
+
+PascalJIT::PascalJIT(std::unique_ptr<Module> module, unsigned opt_level, bool lazy, raw_ostream * ir_out)
+	: opt_level(opt_level), ir_out(ir_out)
+{
+	InitializeNativeTarget();
+	InitializeNativeTargetAsmPrinter();
+	InitializeNativeTargetAsmParser();
+
+	base = module.get();
+	LLVMContext & context = base -> getContext();
+
+	std::string error;
+	EngineBuilder builder(std::move(module));
+	builder.setEngineKind(EngineKind::JIT)
+		.setErrorStr(&error)
+		.setOptLevel(codegenOptLevel(opt_level))
+		.setMCJITMemoryManager(std::make_unique<SectionMemoryManager>());
+
+	TargetMachine * target_machine = builder.selectTarget();
+	if ( !target_machine ) {
+		errs() << error << "\n";
+		throw "Could not select the JIT target";
+	}
+	base -> setTargetTriple(target_machine -> getTargetTriple().str());
+	base -> setDataLayout(target_machine -> createDataLayout());
+
+	Function * compile_callback = nullptr;
+	if ( lazy ) {
+		PointerType * ptr = Type::getInt8PtrTy(context);
+		FunctionType * callback_type = FunctionType::get(ptr, {ptr, Type::getInt32Ty(context)}, false);
+		compile_callback = Function::Create(callback_type, Function::ExternalLinkage, "pas_jit_compile", base);
+		splitFunctions(*base, compile_callback);
+	}
+
+	// main and the stubs are always executed, so they are compiled up front
+	optimizeModule(*base, opt_level, target_machine);
+	if ( ir_out ) {
+		base -> print(*ir_out, nullptr);
+		ir_out -> flush();
+	}
+
+	engine.reset(builder.create(target_machine));
+	if ( !engine ) {
+		errs() << error << "\n";
+		throw "Could not create the JIT";
+	}
+
+	if ( compile_callback )
+		engine -> addGlobalMapping(compile_callback, (void *) &compileCallback);
+}
+
+int PascalJIT::run()
+{
+	uint64_t main_address = engine -> getFunctionAddress("main");
+	if ( !main_address )
+		throw "JIT: program entry point not found";
+
+	auto program_main = (int (*)()) main_address;
+	return program_main();
+}
+
+/**
+ * Optimizes and emits the module of a lazily compiled routine
+ * @param id index into lazy_functions, baked into the routine's stub
+ * @return address of the native routine
+ */
+void * PascalJIT::compileFunction(unsigned id)
+{
+	LazyFunction & lazy = lazy_functions[id];
+	if ( void * address = lazy.address.load(std::memory_order_acquire) )
+		return address;
+	std::lock_guard<std::mutex> lock(compile_mutex);
+	if ( void * address = lazy.address.load(std::memory_order_relaxed) )
+		return address;
+
+	TraceScope scope("jit", lazy.body_name);
+	optimizeModule(*lazy.module, opt_level, engine -> getTargetMachine());
+	// Flushed right away, the program's output comes in between
+	if ( ir_out ) {
+		lazy.module -> print(*ir_out, nullptr);
+		ir_out -> flush();
+	}
+	engine -> addModule(std::move(lazy.module));
+
+	auto address = (void *) engine -> getFunctionAddress(lazy.body_name);
+	if ( !address )
+		report_fatal_error(Twine("JIT: could not compile ") + lazy.body_name);
+
+	lazy.address.store(address, std::memory_order_release);
+	return address;
+}
+
+void * PascalJIT::compileRoutine(const std::string & name)
+{
+	auto id = lazy_ids.find(name);
+	if ( id == lazy_ids.end() )
+		return nullptr;
+
+	// Callees of callees too, so the routine never calls a stub that has to compile
+	std::vector<bool> reached(lazy_functions.size());
+	std::vector<unsigned> pending = {id -> second};
+	reached[id -> second] = true;
+	while ( !pending.empty() ) {
+		unsigned next = pending.back();
+		pending.pop_back();
+		compileFunction(next);
+		for ( unsigned callee : lazy_functions[next].callees ) {
+			if ( !reached[callee] ) {
+				reached[callee] = true;
+				pending.push_back(callee);
+			}
+		}
+	}
+	return lazy_functions[id -> second].address.load(std::memory_order_acquire);
+}
+
+// The variable becomes a declaration resolved to address, the code of every module shares it
+void PascalJIT::mapGlobal(const std::string & name, void * address)
+{
+	GlobalVariable * variable = base -> getNamedGlobal("pas." + name);
+	if ( !variable )
+		variable = base -> getNamedGlobal(name);
+	if ( !variable || variable -> isConstant() )
+		return;
+	variable -> setInitializer(nullptr);
+	variable -> setLinkage(GlobalValue::ExternalLinkage);
+	engine -> addGlobalMapping(variable, address);
+}
+
+/**
+ * Moves every routine body out of the base module and leaves a stub in its place
+ */
+void PascalJIT::splitFunctions(Module & base, Function * compile_callback)
+{
+	// Program variables are shared by all modules, so they need external symbols.
+	// The prefix keeps them from resolving to libc symbols of the same name.
+	for ( GlobalVariable & variable : base.globals() ) {
+		if ( variable.hasLocalLinkage() && !variable.isConstant() ) {
+			variable.setLinkage(GlobalValue::ExternalLinkage);
+			variable.setName("pas." + variable.getName());
+		}
+	}
+
+	// Routines move into modules of their own, so they need external symbols too
+	std::vector<Function *> functions;
+	for ( Function & function : base ) {
+		if ( function.isDeclaration() || function.getName() == "main" )
+			continue;
+		lazy_ids[function.getName().str()] = functions.size();
+		if ( function.hasLocalLinkage() ) {
+			function.setLinkage(GlobalValue::ExternalLinkage);
+			function.setName("pas." + function.getName());
+		}
+		functions.push_back(&function);
+	}
+
+	// Sized once, the addresses are atomic and can't be moved
+	lazy_functions = std::vector<LazyFunction>(functions.size());
+	for ( unsigned id = 0; id < functions.size(); id++ ) {
+		LazyFunction & lazy = lazy_functions[id];
+		lazy.body_name = functions[id] -> getName().str() + ".body";
+		lazy.module = extractFunction(base, *functions[id], lazy.body_name);
+		createStub(base, *functions[id], id, compile_callback);
+	}
+
+	// The stubs keep the names of the routines, which the bodies declare
+	for ( LazyFunction & lazy : lazy_functions ) {
+		for ( Function & callee : *lazy.module ) {
+			if ( !callee.isDeclaration() )
+				continue;
+			auto stub = std::find(functions.begin(), functions.end(), base.getFunction(callee.getName()));
+			if ( stub != functions.end() )
+				lazy.callees.push_back(stub - functions.begin());
+		}
+	}
+}
+
+std::unique_ptr<Module> PascalJIT::extractFunction(Module & base, Function & function, const std::string & body_name)
+{
+	auto module = std::make_unique<Module>(body_name, base.getContext());
+	module -> setTargetTriple(base.getTargetTriple());
+	module -> setDataLayout(base.getDataLayout());
+
+	Function * body = Function::Create(function.getFunctionType(), GlobalValue::ExternalLinkage, body_name, module.get());
+	body -> setCallingConv(function.getCallingConv());
+	body -> setAttributes(function.getAttributes());
+
+	auto body_arg = body -> arg_begin();
+	for ( Argument & arg : function.args() ) {
+		body_arg -> takeName(&arg);
+		arg.replaceAllUsesWith(&*body_arg);
+		++body_arg;
+	}
+	body -> getBasicBlockList().splice(body -> end(), function.getBasicBlockList());
+
+	// Self recursion calls the body directly, everything else goes through declarations
+	ValueToValueMapTy value_map;
+	value_map[&function] = body;
+	DeclarationMaterializer materializer(base, *module);
+	RemapFunction(*body, value_map, RF_IgnoreMissingLocals, nullptr, &materializer);
+
+	return module;
+}
+
+/**
+ * Fills the emptied routine with:
+ *   if routine.addr == null then routine.addr := pas_jit_compile(jit, id);
+ *   tail call routine.addr(args)
+ */
+void PascalJIT::createStub(Module & base, Function & function, unsigned id, Function * compile_callback)
+{
+	LLVMContext & context = base.getContext();
+	IRBuilder<> builder(context);
+	// The body keeps them
+	removeStubbedAttributes(function);
+
+	PointerType * function_ptr_type = function.getFunctionType() -> getPointerTo();
+	auto address_slot = new GlobalVariable(base, function_ptr_type, false, GlobalValue::InternalLinkage,
+	                                       ConstantPointerNull::get(function_ptr_type), function.getName() + ".addr");
+
+	BasicBlock * entry_BB = BasicBlock::Create(context, "entry", &function);
+	BasicBlock * compile_BB = BasicBlock::Create(context, "compile", &function);
+	BasicBlock * call_BB = BasicBlock::Create(context, "call", &function);
+
+	builder.SetInsertPoint(entry_BB);
+	Value * cached = builder.CreateLoad(address_slot, "cached");
+	builder.CreateCondBr(builder.CreateIsNull(cached), compile_BB, call_BB);
+
+	builder.SetInsertPoint(compile_BB);
+	Value * jit = ConstantExpr::getIntToPtr(ConstantInt::get(Type::getInt64Ty(context), (uint64_t) (uintptr_t) this),
+	                                        Type::getInt8PtrTy(context));
+	Value * address = builder.CreateCall(compile_callback, {jit, ConstantInt::get(Type::getInt32Ty(context), id)});
+	Value * compiled = builder.CreateBitCast(address, function_ptr_type);
+	builder.CreateStore(compiled, address_slot);
+	builder.CreateBr(call_BB);
+
+	builder.SetInsertPoint(call_BB);
+	PHINode * target = builder.CreatePHI(function_ptr_type, 2, "target");
+	target -> addIncoming(cached, entry_BB);
+	target -> addIncoming(compiled, compile_BB);
+
+	std::vector<Value *> args;
+	for ( Argument & arg : function.args() )
+		args.push_back(&arg);
+
+	CallInst * result = builder.CreateCall(target, args);
+	result -> setTailCall();
+	result -> setCallingConv(function.getCallingConv());
+
+	if ( function.getReturnType() -> isVoidTy() )
+		builder.CreateRetVoid();
+	else
+		builder.CreateRet(result);
+}
@@ -0,0 +1,60 @@
+#ifndef PAS_COMPILER_JIT_H
+#define PAS_COMPILER_JIT_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+/**
+ * In-memory execution of a generated module.
+ * In lazy mode every user routine is moved to its own module and replaced by a stub,
+ * the routine is optimized and emitted only when the stub is called for the first time.
+ * Routines may be compiled on several threads, one at a time; a stub whose routine is already
+ * compiled doesn't wait for the compiler.
+ */
+class PascalJIT
+{
+public:
+	// ir_out receives the optimized IR, of a lazy routine when it is compiled
+	PascalJIT(std::unique_ptr<llvm::Module> module, unsigned opt_level, bool lazy, llvm::raw_ostream * ir_out = nullptr);
+
+	int run();
+	void * compileFunction(unsigned id);
+	// Compiles a lazy routine and every routine it may call before its first call,
+	// @return its address, null for unknown names
+	void * compileRoutine(const std::string & name);
+	// Places a global variable of the program at address, before any code is run
+	void mapGlobal(const std::string & name, void * address);
+
+private:
+	struct LazyFunction
+	{
+		std::string body_name;
+		std::unique_ptr<llvm::Module> module;
+		std::atomic<void *> address{nullptr};
+		// Lazy routines the body calls
+		std::vector<unsigned> callees;
+	};
+
+	void splitFunctions(llvm::Module & base, llvm::Function * compile_callback);
+	std::unique_ptr<llvm::Module> extractFunction(llvm::Module & base, llvm::Function & function, const std::string & body_name);
+	void createStub(llvm::Module & base, llvm::Function & function, unsigned id, llvm::Function * compile_callback);
+
+	unsigned opt_level;
+	llvm::raw_ostream * ir_out;
+	std::unique_ptr<llvm::ExecutionEngine> engine;
+	llvm::Module * base = nullptr;
+	std::vector<LazyFunction> lazy_functions;
+	// Lazy routines by their name in the generated module
+	std::map<std::string, unsigned> lazy_ids;
+	std::mutex compile_mutex;
+};
+
+#endif //PAS_COMPILER_JIT_H
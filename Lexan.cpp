@@ -30,8 +30,6 @@ std::string Lexan::getStringVal ()
 // TODO lowercase?
 Token Lexan::getToken()
 {
-	static int current_char = ' ';
-
 	while ( isspace(current_char) )
 		current_char = is.get();
 
@@ -89,6 +87,24 @@ Token Lexan::getToken()
 		return tok_string;
 	}
 
+	// { comment } or { $directive }
+	if ( current_char == '{' ) {
+		std::string text;
+		while ( (current_char = is.get()) != '}' ) {
+			// The rest of the file would silently disappear
+			if ( current_char == EOF )
+				throw "Unterminated comment";
+			text += current_char;
+		}
+		current_char = is.get(); // Move beyond }
+
+		if ( !text.empty() && text[0] == '$' ) {
+			identifier_str = text.substr(1);
+			return tok_directive;
+		}
+		return getToken();
+	}
+
 	// Comments (only 1 line)
 	if ( current_char == '#' ) {
 		// Skip everything until EOL or EOF
@@ -52,26 +52,42 @@ enum Token {
 	tok_kwDownTo,
 	tok_kwOr,
 	tok_kwAnd,
+	tok_kwShl,
+	tok_kwShr,
 	tok_kwProcedure,
 	tok_kwFunction,
 	tok_kwForward,
 	tok_kwBreak,
+	tok_kwContinue,
 	tok_kwExit,
 
 	tok_kwWrite,
 	tok_kwRead,
+
+	tok_directive, // {$...} compiler directive, the text after $ is the identifier string
 };
 
 
-class Lexan {
+// Tokens for the parser, the values describe the last token of their kind
+class TokenSource {
+public:
+	virtual ~TokenSource() = default;
+	virtual std::string getIdentifierStr() = 0;
+	virtual int getNumVal() = 0;
+	virtual std::string getStringVal() = 0;
+	virtual Token getToken() = 0;
+};
+
+class Lexan : public TokenSource {
 public:
 	Lexan(const std::string & input_file);
-	std::string getIdentifierStr();
-	int getNumVal();
-	std::string getStringVal();
-	Token getToken();
+	std::string getIdentifierStr() override;
+	int getNumVal() override;
+	std::string getStringVal() override;
+	Token getToken() override;
 private:
 	std::ifstream is;
+	int current_char = ' ';     // lookahead, the last character read
 	std::string identifier_str; // variable name - tok_identifier
 	int num_val;                // tok_number
 	std::string string_val;
@@ -96,11 +112,14 @@ private:
 		{"downto", tok_kwDownTo},
 		{"or", tok_kwOr},
 		{"and", tok_kwAnd},
+		{"shl", tok_kwShl},
+		{"shr", tok_kwShr},
 
 		{"procedure", tok_kwProcedure},
 		{"function", tok_kwFunction},
 		{"forward", tok_kwForward},
 		{"break", tok_kwBreak},
+		{"continue", tok_kwContinue},
 		{"exit", tok_kwExit},
 
 /*		{"writeln", tok_kwWrite},
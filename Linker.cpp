@@ -0,0 +1,72 @@
+#include "Linker.h"
+#include "LinkerConfig.h"
+
+#include <mutex>
+#include <vector>
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+#ifdef PAS_WITH_LLD
+#include "lld/Common/Driver.h"
+#endif
+
+using namespace llvm;
+
+// Same command line the compiler driver would build for a dynamically linked C program
+static std::vector<std::string> linkerArguments(const std::string & object_file, const std::string & output_file)
+{
+	return {
+		"ld",
+		"-o", output_file,
+		"--eh-frame-hdr",
+		"-dynamic-linker", PAS_DYNAMIC_LINKER,
+		PAS_CRT1, PAS_CRTI, PAS_CRTBEGIN,
+		object_file,
+		"-L" PAS_LIBC_DIR, "-L" PAS_LIBGCC_DIR,
+		"-lc", "-lgcc",
+		PAS_CRTEND, PAS_CRTN
+	};
+}
+
+bool linkExecutable(const std::string & object_file, const std::string & output_file, std::string & error)
+{
+	if ( !PAS_LINK_SUPPORTED ) {
+		error = "Linking executables is only supported on ELF platforms";
+		return false;
+	}
+
+	std::vector<std::string> arguments = linkerArguments(object_file, output_file);
+	std::vector<const char *> argv;
+	for ( const std::string & arg : arguments )
+		argv.push_back(arg.c_str());
+
+#ifdef PAS_WITH_LLD
+	// lld keeps global state, one link at a time
+	static std::mutex lld_mutex;
+	std::lock_guard<std::mutex> lock(lld_mutex);
+
+	raw_string_ostream diagnostics(error);
+#if LLVM_VERSION_MAJOR >= 14
+	bool linked = lld::elf::link(argv, diagnostics, diagnostics, false, false);
+#elif LLVM_VERSION_MAJOR >= 10
+	bool linked = lld::elf::link(argv, false, diagnostics, diagnostics);
+#else
+	bool linked = lld::elf::link(argv, false, diagnostics);
+#endif
+	diagnostics.flush();
+	return linked;
+#else
+	argv.push_back(nullptr);
+	bool execution_failed = false;
+	int result = sys::ExecuteAndWait(PAS_SYSTEM_LINKER, argv.data(), nullptr, {}, 0, 0, &error, &execution_failed);
+	if ( execution_failed )
+		return false;
+	if ( result != 0 ) {
+		error = "Linker returned " + std::to_string(result);
+		return false;
+	}
+	return true;
+#endif
+}
@@ -0,0 +1,15 @@
+#ifndef PAS_COMPILER_LINKER_H
+#define PAS_COMPILER_LINKER_H
+
+#include <string>
+
+/**
+ * Links an object file with the C runtime into an executable.
+ * Uses lld in-process when built with PAS_WITH_LLD, otherwise runs the system linker
+ * directly, in both cases without starting a compiler driver.
+ * @param error set to the linker diagnostics on failure
+ * @return true on success
+ */
+bool linkExecutable(const std::string & object_file, const std::string & output_file, std::string & error);
+
+#endif //PAS_COMPILER_LINKER_H
@@ -0,0 +1,56 @@
+#include "Optimizer.h"
+
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Scalar.h"
+
+#include "Trace.h"
+
+using namespace llvm;
+
+void optimizeModule(Module & module, unsigned opt_level, TargetMachine * target_machine, CompileReport * report)
+{
+	if ( opt_level == 0 )
+		return;
+
+	PassManagerBuilder builder;
+	builder.OptLevel = opt_level;
+	builder.SizeLevel = 0;
+	if ( opt_level > 1 )
+		builder.Inliner = createFunctionInliningPass(opt_level, 0, false);
+	builder.LoopVectorize = opt_level > 1;
+	builder.SLPVectorize = opt_level > 1;
+	// Replaces the range checks of induction variables by checks of the loop bounds before the loop
+	if ( opt_level > 1 )
+		builder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd,
+		                     [](const PassManagerBuilder &, legacy::PassManagerBase & manager) {
+			                     manager.add(createInductiveRangeCheckEliminationPass());
+		                     });
+
+	TracingPassManager<legacy::FunctionPassManager> function_passes(&module);
+	TracingPassManager<legacy::PassManager> module_passes;
+	if ( target_machine ) {
+		target_machine -> adjustPassManager(builder);
+		function_passes.add(createTargetTransformInfoWrapperPass(target_machine -> getTargetIRAnalysis()));
+		module_passes.add(createTargetTransformInfoWrapperPass(target_machine -> getTargetIRAnalysis()));
+	}
+	builder.populateFunctionPassManager(function_passes);
+	builder.populateModulePassManager(module_passes);
+
+	{
+		PhaseTimer timer(report, "Function optimization");
+		function_passes.doInitialization();
+		for ( Function & f : module ) {
+			if ( f.isDeclaration() )
+				continue;
+			TraceScope scope("optimize", f.getName().str());
+			function_passes.run(f);
+		}
+		function_passes.doFinalization();
+	}
+
+	PhaseTimer timer(report, "Module optimization");
+	module_passes.run(module);
+}
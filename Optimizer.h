@@ -0,0 +1,14 @@
+#ifndef PAS_COMPILER_OPTIMIZER_H
+#define PAS_COMPILER_OPTIMIZER_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include "Report.h"
+
+// Runs the standard -O<level> pipeline over the whole module, level 0 is a no-op.
+// Without a target machine the vectorizers and the unroller have no cost model and do nothing.
+void optimizeModule(llvm::Module & module, unsigned opt_level, llvm::TargetMachine * target_machine = nullptr,
+                    CompileReport * report = nullptr);
+
+#endif //PAS_COMPILER_OPTIMIZER_H
@@ -0,0 +1,193 @@
+#include "Options.h"
+
+#include <cstdio>
+#include <cctype>
+#include <cstdlib>
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/Host.h"
+
+void printUsage(const char * program_name)
+{
+	printf("Usage: %s [options] <input_file>...\n", program_name);
+	printf("Arguments may also be read from response files given as @<file>\n");
+	printf("Options:\n");
+	printf("  -j<n>          compile several inputs on n threads (default one per core)\n");
+	printf("  -o <file>      output file (default output.<ext>, a.out with --exe)\n");
+	printf("  --emit=<kind>  obj, asm, llvm (textual IR) or bc (bitcode), default obj\n");
+	printf("  --target=<triple>  generate code for another target (needs a build with PAS_ALL_TARGETS)\n");
+	printf("  --print-ir     print the final LLVM IR to stdout\n");
+	printf("  --streaming           generate each routine as soon as it is parsed and free its AST\n");
+	printf("  --pipeline            like --streaming, lexing, parsing and code generation on three threads\n");
+	printf("  --time-report[=json]  print wall and CPU time and peak memory of every compilation phase\n");
+	printf("  --stats[=json]        print token, AST node, function, basic block and instruction counts\n");
+	printf("  --trace=<file>        write Chrome trace events of phases, routines and LLVM passes\n");
+	printf("  --exe          link an executable instead of writing an object file\n");
+	printf("  --cache-dir=<dir>   reuse outputs of identical compilations (also $PAS_CACHE_DIR)\n");
+	printf("  --cache-size=<MiB>  cache size limit, least recently used entries are evicted (default 512, 0 = unlimited)\n");
+	printf("  -O<level>      optimization level 0-3 (default 0)\n");
+	printf("  --range-checks  check array indices, like {$R+} at the start of the program\n");
+	printf("  --stack-array-limit=<bytes>  allocate larger local arrays on the heap (default 65536)\n");
+	printf("  --jit          compile and run the program in memory\n");
+	printf("  --jit-eager    with --jit, compile every routine before running main\n");
+	printf("  --interpret    run the program on its syntax tree, without LLVM\n");
+	printf("  --vm           run the program on the bytecode VM, without LLVM (--print-ir prints the bytecode)\n");
+	printf("  --tiered       run the program on the VM and its hot routines compiled by the JIT\n");
+	printf("  --serve=<socket>      run as a compile server listening on a Unix domain socket\n");
+	printf("  --server-threads=<n>  compile server worker threads (default one per core)\n");
+	printf("  --connect=<socket>    compile on a running server (also $PAS_SERVER), locally if none answers\n");
+}
+
+/**
+ * Fills options from command line arguments
+ * @param error set to the reason of failure
+ * @return true on success, else false
+ */
+bool parseOptions(int argc, const char * const argv[], CompileOptions & options, std::string & error)
+{
+	for ( int i = 1; i < argc; i++ ) {
+		std::string arg = argv[i];
+
+		if ( arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3' ) {
+			options.opt_level = arg[2] - '0';
+		} else if ( arg.compare(0, 2, "-j") == 0 && arg.size() > 2 && isdigit(arg[2]) ) {
+			options.jobs = strtoul(arg.c_str() + 2, nullptr, 10);
+		} else if ( arg == "-o" ) {
+			if ( ++i == argc ) {
+				error = "Missing file name after -o";
+				return false;
+			}
+			options.output_file = argv[i];
+		} else if ( arg.compare(0, 7, "--emit=") == 0 ) {
+			std::string kind = arg.substr(7);
+			if ( kind == "obj" )
+				options.emit = emit_object;
+			else if ( kind == "asm" )
+				options.emit = emit_assembly;
+			else if ( kind == "llvm" )
+				options.emit = emit_llvm;
+			else if ( kind == "bc" )
+				options.emit = emit_bitcode;
+			else {
+				error = "Unknown output kind '" + kind + "'";
+				return false;
+			}
+		} else if ( arg.compare(0, 9, "--target=") == 0 ) {
+			options.target_triple = arg.substr(9);
+		} else if ( arg == "--print-ir" ) {
+			options.print_ir = true;
+		} else if ( arg == "--streaming" ) {
+			options.streaming = true;
+		} else if ( arg == "--pipeline" ) {
+			options.streaming = true;
+			options.pipeline = true;
+		} else if ( arg == "--time-report" || arg == "--time-report=json" ) {
+			options.time_report = true;
+			options.report_json |= arg == "--time-report=json";
+		} else if ( arg.compare(0, 8, "--trace=") == 0 ) {
+			options.trace_file = arg.substr(8);
+		} else if ( arg == "--stats" || arg == "--stats=json" ) {
+			options.stats = true;
+			options.report_json |= arg == "--stats=json";
+		} else if ( arg == "--exe" ) {
+			options.executable = true;
+		} else if ( arg.compare(0, 12, "--cache-dir=") == 0 ) {
+			options.cache_dir = arg.substr(12);
+		} else if ( arg.compare(0, 13, "--cache-size=") == 0 ) {
+			options.cache_max_size = strtoull(arg.c_str() + 13, nullptr, 10) << 20;
+		} else if ( arg == "--range-checks" ) {
+			options.range_checks = true;
+		} else if ( arg.compare(0, 20, "--stack-array-limit=") == 0 ) {
+			options.stack_array_limit = strtoull(arg.c_str() + 20, nullptr, 10);
+		} else if ( arg == "--jit" ) {
+			options.jit = true;
+		} else if ( arg == "--jit-eager" ) {
+			options.jit = true;
+			options.lazy_jit = false;
+		} else if ( arg == "--interpret" ) {
+			options.interpret = true;
+		} else if ( arg == "--vm" ) {
+			options.vm = true;
+		} else if ( arg == "--tiered" ) {
+			options.tiered = true;
+		} else if ( arg.compare(0, 8, "--serve=") == 0 ) {
+			options.serve_socket = arg.substr(8);
+		} else if ( arg.compare(0, 17, "--server-threads=") == 0 ) {
+			options.server_threads = strtoul(arg.c_str() + 17, nullptr, 10);
+		} else if ( arg.compare(0, 10, "--connect=") == 0 ) {
+			options.connect_socket = arg.substr(10);
+		} else if ( arg.size() > 1 && arg[0] == '-' ) {
+			error = "Unknown option '" + arg + "'";
+			return false;
+		} else {
+			options.input_files.push_back(arg);
+		}
+	}
+
+	// The server gets its inputs from the clients
+	if ( !options.serve_socket.empty() )
+		return true;
+
+	if ( options.input_files.empty() ) {
+		error = "No input file";
+		return false;
+	}
+	if ( options.cache_dir.empty() && getenv("PAS_CACHE_DIR") )
+		options.cache_dir = getenv("PAS_CACHE_DIR");
+	if ( options.connect_socket.empty() && getenv("PAS_SERVER") )
+		options.connect_socket = getenv("PAS_SERVER");
+
+	if ( options.executable && options.emit != emit_object ) {
+		error = "--exe can only be combined with --emit=obj";
+		return false;
+	}
+	// Only the host can link and run the program
+	bool runs = options.jit || options.interpret || options.vm || options.tiered;
+	if ( !options.target_triple.empty() && (options.executable || runs) ) {
+		error = "--target can't be combined with --exe, --jit, --interpret, --vm or --tiered";
+		return false;
+	}
+	// The interpreter and the VM need the whole syntax tree
+	int tree_runners = options.interpret + options.vm + options.tiered;
+	if ( tree_runners > 1 || (tree_runners && (options.jit || options.streaming)) ) {
+		error = "--interpret, --vm and --tiered can't be combined with each other, --jit, --streaming or --pipeline";
+		return false;
+	}
+	options.target_triple = options.target_triple.empty() ? llvm::sys::getDefaultTargetTriple()
+	                                                      : llvm::Triple::normalize(options.target_triple);
+
+	// Several inputs are written next to their sources, see outputFileFor
+	if ( options.input_files.size() > 1 ) {
+		if ( !options.output_file.empty() || runs ) {
+			error = "-o, --jit, --interpret, --vm and --tiered need a single input file";
+			return false;
+		}
+		return true;
+	}
+	options.input_file = options.input_files[0];
+
+	if ( options.output_file.empty() ) {
+		static const char * extensions[] = {"o", "s", "ll", "bc"};
+		options.output_file = options.executable ? "a.out" : std::string("output.") + extensions[options.emit];
+	}
+	return true;
+}
+
+/**
+ * Output of one of several inputs, the input with the extension of the output kind
+ * (none for executables), e.g. dir/a.pas -> dir/a.o
+ */
+std::string outputFileFor(const CompileOptions & options, const std::string & input_file)
+{
+	static const char * extensions[] = {".o", ".s", ".ll", ".bc"};
+
+	std::string output = input_file;
+	size_t extension = output.find_last_of("./");
+	if ( extension != std::string::npos && output[extension] == '.' && extension > 0 && output[extension - 1] != '/' )
+		output.erase(extension);
+
+	if ( !options.executable )
+		return output + extensions[options.emit];
+	// Never overwrite a source without extension
+	return output == input_file ? output + ".out" : output;
+}
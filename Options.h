@@ -0,0 +1,53 @@
+#ifndef PAS_COMPILER_OPTIONS_H
+#define PAS_COMPILER_OPTIONS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Output format selected by --emit
+enum EmitKind {
+	emit_object,
+	emit_assembly,
+	emit_llvm,
+	emit_bitcode,
+};
+
+// Command line configuration of a single compiler invocation.
+// Options changing the output must also be part of the cache key (Cache.cpp).
+struct CompileOptions
+{
+	std::vector<std::string> input_files;
+	unsigned jobs = 0;          // -j, parallel compilations of several inputs, 0 for one per core
+	std::string input_file;     // the input being compiled, set directly when there is just one
+	std::string output_file;    // -o, defaults to output.<ext> or a.out, <input>.<ext> or <input> with several inputs
+	EmitKind emit = emit_object;
+	std::string target_triple;  // --target, normalized, the host triple by default
+	bool executable = false;    // --exe, link a finished executable
+	bool print_ir = false;      // --print-ir, dump the final IR to stdout
+	bool streaming = false;     // --streaming, generate each routine right after parsing it
+	bool pipeline = false;      // --pipeline, streaming with lexer, parser and codegen on separate threads
+	bool time_report = false;   // --time-report, phase times and peak memory
+	bool stats = false;         // --stats, token, AST node and IR counts
+	bool report_json = false;   // =json on either of them, one JSON object per input
+	std::string trace_file;     // --trace, Chrome trace events of the whole run
+	unsigned opt_level = 0;     // -O0 .. -O3
+	bool range_checks = false;  // --range-checks, check array indices as if the program started with {$R+}
+	uint64_t stack_array_limit = 64 << 10; // --stack-array-limit, larger local arrays are allocated on the heap
+	bool jit = false;           // --jit, run the program instead of writing an object file
+	bool lazy_jit = true;       // --jit-eager disables per-function lazy compilation
+	bool interpret = false;     // --interpret, run the program on its syntax tree without LLVM
+	bool vm = false;            // --vm, run the program compiled to bytecode without LLVM
+	bool tiered = false;        // --tiered, start on the VM and compile hot routines with the JIT
+	std::string cache_dir;      // --cache-dir or $PAS_CACHE_DIR, empty disables the cache
+	uint64_t cache_max_size = 512 << 20;
+	std::string serve_socket;   // --serve, run as a compile server instead of compiling
+	unsigned server_threads = 0;
+	std::string connect_socket; // --connect or $PAS_SERVER, forward the invocation to a compile server
+};
+
+bool parseOptions(int argc, const char * const argv[], CompileOptions & options, std::string & error);
+std::string outputFileFor(const CompileOptions & options, const std::string & input_file);
+void printUsage(const char * program_name);
+
+#endif //PAS_COMPILER_OPTIONS_H
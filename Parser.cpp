@@ -6,6 +6,8 @@
 
 #include "Parser.h"
 
+#include <algorithm>
+
 static std::string tokenToStr( Token tok )
 {
 	switch ( tok ) {
@@ -98,6 +100,10 @@ static std::string tokenToStr( Token tok )
 			return "or";
 		case tok_kwAnd :
 			return "and";
+		case tok_kwShl :
+			return "shl";
+		case tok_kwShr :
+			return "shr";
 
 		case tok_kwProcedure :
 			return "procedure";
@@ -107,6 +113,8 @@ static std::string tokenToStr( Token tok )
 			return "forward";
 		case tok_kwBreak :
 			return "break";
+		case tok_kwContinue :
+			return "continue";
 		case tok_kwExit :
 			return "exit";
 
@@ -114,13 +122,82 @@ static std::string tokenToStr( Token tok )
 			return "writeln";
 		case tok_kwRead :
 			return "readln";
+		case tok_directive :
+			return "directive";
 
 		default:
 			return "UNDEFINED TOKEN";
 	}
 }
 
-Parser::Parser (const std::string & file_name) : lexan(file_name)
+Parser::Parser (const std::string & file_name) : Parser(std::make_unique<Lexan>(file_name))
+{
+	time_tokens = true;
+}
+
+void Parser::setReport(CompileReport * report)
+{
+	this -> report = report;
+	// Only once, the lexer may already be wrapped
+	if ( report && time_tokens ) {
+		lexan = std::make_unique<TimedTokenSource>(std::move(lexan), *report);
+		time_tokens = false;
+	}
+}
+
+Token TimedTokenSource::getToken()
+{
+	// The end of file stays the current token
+	if ( finished )
+		return tok_eof;
+	if ( position == batch.size() )
+		lexBatch();
+
+	Entry & entry = batch[position++];
+	if ( entry.token == tok_identifier || entry.token >= tok_kwProgram )
+		identifier_str.swap(entry.text);
+	else if ( entry.token == tok_number )
+		num_val = entry.num_val;
+	else if ( entry.token == tok_string )
+		string_val.swap(entry.text);
+
+	finished = entry.token == tok_eof;
+	return entry.token;
+}
+
+void TimedTokenSource::lexBatch()
+{
+	if ( error )
+		std::rethrow_exception(error);
+
+	batch.clear();
+	position = 0;
+	auto start = CompileReport::now();
+	try {
+		while ( batch.size() < batch_size && !lexed_eof ) {
+			Entry entry{source -> getToken(), 0, ""};
+			if ( entry.token == tok_identifier || entry.token >= tok_kwProgram )
+				entry.text = source -> getIdentifierStr();
+			else if ( entry.token == tok_number )
+				entry.num_val = source -> getNumVal();
+			else if ( entry.token == tok_string )
+				entry.text = source -> getStringVal();
+			lexed_eof = entry.token == tok_eof;
+			batch.push_back(std::move(entry));
+		}
+	} catch (...) {
+		error = std::current_exception();
+	}
+	report.addTime("Lexing", start);
+	report.tokens += batch.size();
+	if ( lexed_eof || error )
+		report.notePeakMemory("Lexing");
+
+	if ( batch.empty() )
+		std::rethrow_exception(error);
+}
+
+Parser::Parser (std::unique_ptr<TokenSource> tokens) : lexan(std::move(tokens))
 {
 	// Lowest priority
 	//bin_op_precedence[Token::tok_assign] = 10;
@@ -140,6 +217,8 @@ Parser::Parser (const std::string & file_name) : lexan(file_name)
 	bin_op_precedence[Token::tok_kwDiv] = 40;
 	bin_op_precedence[Token::tok_kwMod] = 40;
 	bin_op_precedence[Token::tok_kwAnd] = 40;
+	bin_op_precedence[Token::tok_kwShl] = 40;
+	bin_op_precedence[Token::tok_kwShr] = 40;
 }
 
 /**
@@ -149,44 +228,68 @@ Parser::Parser (const std::string & file_name) : lexan(file_name)
  * [function] [procedure]
  * [main]
  */
-std::unique_ptr<ASTProgram> Parser::start()
+void Parser::parse(ASTConsumer & consumer)
 {
 	getNextToken();
 	validateToken(tok_kwProgram);	getNextToken();
 
 	validateToken(tok_identifier);
-	std::string program_name = lexan.getIdentifierStr();
+	std::string program_name = lexan -> getIdentifierStr();
 	getNextToken();
 
 	validateToken(tok_semicolon); getNextToken();
 
-	std::vector<std::unique_ptr<ASTVariableDef>> global;
-	std::vector<std::unique_ptr<ASTFunction>> functions;
-	std::unique_ptr<ASTBody> main;
-
+	consumer.startProgram(program_name);
 
 	while ( 1 ) {
 		if ( current_token == tok_kwVar ) {
 			auto global_vars = parseVarDecl();
 			for ( auto & v : global_vars )
-				global.push_back(std::move(v));
+				consumer.addGlobal(std::move(v));
 		} else if ( current_token == tok_kwConst ) {
 			auto const_vars = parseConstVarDecl();
 			for ( auto & v : const_vars )
-				global.push_back(std::move(v));
+				consumer.addGlobal(std::move(v));
 		} else if ( current_token == tok_kwProcedure || current_token == tok_kwFunction ) {
-			functions.emplace_back(parseFunction());
+			consumer.addFunction(parseFunction());
 		} else {
 			// Parse main
-			main = parseBody();
+			auto main = parseBody();
+			validateToken(tok_dot); getNextToken();
+			consumer.finishProgram(std::move(main));
 			break;
 		}
 	}
+}
+
+// Keeps all the parts of the program
+class ProgramCollector : public ASTConsumer
+{
+public:
+	void startProgram(const std::string & name) override { this -> name = name; }
+	void addGlobal(std::unique_ptr<ASTVariableDef> global) override
+	{
+		this -> global.push_back(std::move(global));
+		routines_before.push_back(functions.size());
+	}
+	void addFunction(std::unique_ptr<ASTFunction> function) override { functions.push_back(std::move(function)); }
+	void finishProgram(std::unique_ptr<ASTBody> main) override { this -> main = std::move(main); }
 
-	validateToken(tok_dot); getNextToken();
+	std::string name;
+	std::vector<std::unique_ptr<ASTVariableDef>> global;
+	std::vector<std::unique_ptr<ASTFunction>> functions;
+	std::unique_ptr<ASTBody> main;
+	std::vector<size_t> routines_before;
+};
 
+std::unique_ptr<ASTProgram> Parser::start()
+{
+	ProgramCollector program;
+	parse(program);
 
-	return std::make_unique<ASTProgram>(program_name, std::move(global), std::move(functions), std::move(main));
+	auto result = makeNode<ASTProgram>("Program", program.name, std::move(program.global), std::move(program.functions), std::move(program.main));
+	result -> routines_before = std::move(program.routines_before);
+	return result;
 }
 
 /**
@@ -202,7 +305,7 @@ std::unique_ptr<ASTNumber> Parser::parseNumberExpr()
 	}
 
 	validateToken(tok_number);
-	auto res = std::make_unique<ASTNumber>(sgn * lexan.getNumVal());
+	auto res = makeNode<ASTNumber>("Number", sgn * lexan -> getNumVal());
 	getNextToken();
 
 	return std::move(res);
@@ -215,7 +318,7 @@ std::unique_ptr<ASTNumber> Parser::parseNumberExpr()
 std::unique_ptr<ASTString> Parser::parseStringExpr()
 {
 	validateToken(tok_string);
-	auto res = std::make_unique<ASTString>(lexan.getStringVal());
+	auto res = makeNode<ASTString>("String", lexan -> getStringVal());
 	getNextToken();
 
 	return std::move(res);
@@ -240,7 +343,7 @@ std::unique_ptr<ASTExpression> Parser::parseParenthesisExpr()
 std::unique_ptr<ASTExpression> Parser::parseIdentifierExpr()
 {
 	validateToken(tok_identifier);
-	std::string identifier = lexan.getIdentifierStr();
+	std::string identifier = lexan -> getIdentifierStr();
 	getNextToken(); // Move beyond identifier
 
 
@@ -253,7 +356,7 @@ std::unique_ptr<ASTExpression> Parser::parseIdentifierExpr()
 		if ( current_token == tok_leftBracket )
 			variable_ref = std::move(parseArrayReference(identifier));
 		else
-			variable_ref = std::make_unique<ASTSingleVarReference>(identifier);
+			variable_ref = makeNode<ASTSingleVarReference>("SingleVarReference", identifier);
 
 		if ( current_token == tok_assign )
 			return parseAssign(std::move(variable_ref));
@@ -281,7 +384,7 @@ std::unique_ptr<ASTExpression> Parser::parseIdentifierExpr()
 
 	getNextToken(); // Eat ")"
 
-	return std::make_unique<ASTFunctionCall>(identifier, std::move(arguments));
+	return makeNode<ASTFunctionCall>("FunctionCall", identifier, std::move(arguments));
 }
 std::unique_ptr<ASTExpression> Parser::parsePrimaryExpr()
 {
@@ -334,7 +437,7 @@ std::unique_ptr<ASTExpression> Parser::parseBinaryOperatorRHS(int precedence, st
 				return nullptr;
 		}
 
-		LHS = std::make_unique<ASTBinaryOperator>(bin_op, std::move(LHS), std::move(RHS));
+		LHS = makeNode<ASTBinaryOperator>("BinaryOperator", bin_op, std::move(LHS), std::move(RHS));
 	}
 }
 
@@ -345,7 +448,8 @@ std::unique_ptr<ASTExpression> Parser::parseStatement()
 
 /**
  * [type]
- * 'integer' | 'array' '[' [number] '..' [number] ']' 'of' [type]
+ * 'integer' | 'array' '[' expression '..' expression ']' 'of' [type]
+ * The bounds are constant expressions, evaluated by codegen
  */
 std::shared_ptr<ASTVariableType> Parser::parseVarType()
 {
@@ -358,13 +462,13 @@ std::shared_ptr<ASTVariableType> Parser::parseVarType()
 		validateToken(tok_leftBracket);	getNextToken(); // Eat '['
 
 		// Lower idx
-		std::unique_ptr<ASTNumber> lower_idx = parseNumberExpr();
+		std::unique_ptr<ASTExpression> lower_idx = parseExpression();
 
 		// ..
 		validateToken(tok_dot);	getNextToken();
 		validateToken(tok_dot);	getNextToken();
 
-		std::unique_ptr<ASTNumber> upper_idx = parseNumberExpr();
+		std::unique_ptr<ASTExpression> upper_idx = parseExpression();
 
 		validateToken(tok_rightBracket); getNextToken(); // Eat ']'
 
@@ -390,14 +494,14 @@ std::vector<std::unique_ptr<ASTVariable>> Parser::parseVarDecl ()
 
 	if ( current_token == tok_identifier ) {
 		variable_names.clear();
-		variable_names.push_back(lexan.getIdentifierStr());
+		variable_names.push_back(lexan -> getIdentifierStr());
 		getNextToken();
 
 		while ( current_token == tok_comma ) {
 			getNextToken(); // "Eat ','
 
 			validateToken(tok_identifier);
-			variable_names.push_back(lexan.getIdentifierStr());
+			variable_names.push_back(lexan -> getIdentifierStr());
 			getNextToken();
 		}
 
@@ -409,14 +513,15 @@ std::vector<std::unique_ptr<ASTVariable>> Parser::parseVarDecl ()
 		getNextToken();
 
 		for ( const std::string &name : variable_names )
-			result.emplace_back(std::make_unique<ASTVariable>(name, type));
+			result.emplace_back(makeNode<ASTVariable>("Variable", name, type));
 	}
 
 	return result;
 }
 /**
  * [const_declaration]
- * 'const' {identifier '=' value ';'}+
+ * 'const' {identifier '=' expression ';'}+
+ * The expression is evaluated by codegen, it can use earlier constants and call pure functions
  */
 std::vector<std::unique_ptr<ASTConstVariable>> Parser::parseConstVarDecl ()
 {
@@ -427,15 +532,13 @@ std::vector<std::unique_ptr<ASTConstVariable>> Parser::parseConstVarDecl ()
 
 	do {
 		validateToken(tok_identifier);
-		std::string name = lexan.getIdentifierStr();
+		std::string name = lexan -> getIdentifierStr();
 		getNextToken();
 
 		validateToken(tok_equal);
 		getNextToken();
 
-		validateToken(tok_number);
-		result.emplace_back(std::make_unique<ASTConstVariable>(name, lexan.getNumVal()));
-		getNextToken();
+		result.emplace_back(makeNode<ASTConstVariable>("ConstVariable", name, parseExpression()));
 
 		validateToken(tok_semicolon);
 		getNextToken();
@@ -464,10 +567,13 @@ std::unique_ptr<ASTExpression> Parser::parseContentLine()
 			return parseWhileExpr();
 		case tok_kwBreak:
 			getNextToken();
-			return std::make_unique<ASTBreak>();
+			return makeNode<ASTBreak>("Break");
+		case tok_kwContinue:
+			getNextToken();
+			return makeNode<ASTContinue>("Continue");
 		case tok_kwExit:
 			getNextToken();
-			return std::make_unique<ASTExit>();
+			return makeNode<ASTExit>("Exit");
 		default:
 			return nullptr;
 	}
@@ -491,19 +597,21 @@ std::unique_ptr<ASTBody> Parser::parseBody ()
 					break;
 				content.emplace_back(parseContentLine());
 			}
-			//validateToken(tok_semicolon); getNextToken();
+			// A token no statement starts with, e.g. one the lexer didn't recognize, would be read forever
+			if ( current_token != tok_kwEnd && current_token != tok_eof )
+				validateToken(tok_semicolon);
 		}
 		validateToken(tok_kwEnd); getNextToken();
 	} else {
 		content.emplace_back(parseContentLine());
 	}
 
-	return std::make_unique<ASTBody>(std::move(content));
+	return makeNode<ASTBody>("Body", std::move(content));
 }
 
 /**
  * [function_proto]
- * 'function' function_name '(' {var_name ':' [type] ';'}* ')' ':' [type] ';'
+ * 'function' function_name '(' {{'var' | 'const'} var_name ':' [type] ';'}* ')' ':' [type] ';'
  */
 std::unique_ptr<ASTFunctionPrototype> Parser::parseFunctionPrototype ()
 {
@@ -518,17 +626,23 @@ std::unique_ptr<ASTFunctionPrototype> Parser::parseFunctionPrototype ()
 	getNextToken();
 
 	validateToken(tok_identifier);
-	std::string function_name = lexan.getIdentifierStr();
+	std::string function_name = lexan -> getIdentifierStr();
 	getNextToken();
 
 	validateToken(tok_leftParenthesis);
 	getNextToken();
 
-	std::vector<std::unique_ptr<ASTVariable>> params;
+	std::vector<std::unique_ptr<ASTParameter>> params;
 
 	// Params
-	while ( current_token == tok_identifier ) {
-		std::string param_name = lexan.getIdentifierStr();
+	while ( current_token == tok_identifier || current_token == tok_kwVar || current_token == tok_kwConst ) {
+		ASTParameter::Mode mode = ASTParameter::value;
+		if ( current_token != tok_identifier ) {
+			mode = current_token == tok_kwVar ? ASTParameter::var : ASTParameter::constant;
+			getNextToken();
+			validateToken(tok_identifier);
+		}
+		std::string param_name = lexan -> getIdentifierStr();
 		getNextToken();
 
 		validateToken(tok_colon);
@@ -536,7 +650,7 @@ std::unique_ptr<ASTFunctionPrototype> Parser::parseFunctionPrototype ()
 
 		auto type = parseVarType();
 
-		params.emplace_back(std::make_unique<ASTVariable>(param_name, type));
+		params.emplace_back(makeNode<ASTParameter>("Parameter", param_name, type, mode));
 
 		if ( current_token != tok_semicolon )
 			break;
@@ -559,7 +673,7 @@ std::unique_ptr<ASTFunctionPrototype> Parser::parseFunctionPrototype ()
 	validateToken(tok_semicolon);
 	getNextToken();
 
-	return std::make_unique<ASTFunctionPrototype>(function_name, std::move(params), return_type);
+	return makeNode<ASTFunctionPrototype>("FunctionPrototype", function_name, std::move(params), return_type);
 }
 
 
@@ -581,7 +695,7 @@ std::unique_ptr<ASTFunction> Parser::parseFunction()
 		validateToken(tok_semicolon);
 		getNextToken();
 
-		return std::make_unique<ASTFunction>(std::move(prototype), std::move(local), nullptr);
+		return makeNode<ASTFunction>("Function", std::move(prototype), std::move(local), nullptr);
 	}
 
 	// Parse local variable declarations
@@ -598,7 +712,7 @@ std::unique_ptr<ASTFunction> Parser::parseFunction()
 	validateToken(tok_semicolon);
 	getNextToken();
 
-	return std::make_unique<ASTFunction>(std::move(prototype), std::move(local), std::move(body));
+	return makeNode<ASTFunction>("Function", std::move(prototype), std::move(local), std::move(body));
 }
 
 /**
@@ -623,9 +737,9 @@ std::unique_ptr<ASTIf> Parser::parseIfExpr()
 		getNextToken();
 		auto else_body = parseBody();
 
-		return std::make_unique<ASTIf>(std::move(condition), std::move(then_body), std::move(else_body));
+		return makeNode<ASTIf>("If", std::move(condition), std::move(then_body), std::move(else_body));
 	}
-	return std::make_unique<ASTIf>(std::move(condition), std::move(then_body), nullptr);
+	return makeNode<ASTIf>("If", std::move(condition), std::move(then_body), nullptr);
 }
 
 /**
@@ -639,7 +753,7 @@ std::unique_ptr<ASTFor> Parser::parseForExpr()
 	getNextToken();
 
 	validateToken(tok_identifier);
-	std::string control_variable = lexan.getIdentifierStr();
+	std::string control_variable = lexan -> getIdentifierStr();
 	getNextToken();
 
 	validateToken(tok_assign);
@@ -670,7 +784,7 @@ std::unique_ptr<ASTFor> Parser::parseForExpr()
 
 	auto for_body = parseBody();
 
-	return std::make_unique<ASTFor>(control_variable, std::move(start), std::move(end)
+	return makeNode<ASTFor>("For", control_variable, std::move(start), std::move(end)
 		, std::move(step), std::move(for_body), downto);
 }
 
@@ -689,7 +803,7 @@ std::unique_ptr<ASTWhile> Parser::parseWhileExpr()
 
 	auto while_body = parseBody();
 
-	return std::make_unique<ASTWhile>(std::move(condition), std::move(while_body));
+	return makeNode<ASTWhile>("While", std::move(condition), std::move(while_body));
 }
 
 
@@ -708,7 +822,7 @@ std::unique_ptr<ASTArrayReference>  Parser::parseArrayReference(const std::strin
 
 	validateToken(tok_rightBracket); getNextToken();
 
-	return std::make_unique<ASTArrayReference>(name, std::move(idx));
+	return makeNode<ASTArrayReference>("ArrayReference", name, std::move(idx), range_checks);
 }
 /**
  * [var_reference] ':=' expression
@@ -716,20 +830,20 @@ std::unique_ptr<ASTArrayReference>  Parser::parseArrayReference(const std::strin
 std::unique_ptr<ASTAssignOp> Parser::parseAssign(const std::string & var_name)
 {
 	/*	validateToken(tok_identifier);
-	std::string variable_name = lexan.getIdentifierStr();
+	std::string variable_name = lexan -> getIdentifierStr();
 	getNextToken();*/
 
 	std::unique_ptr<ASTReference> variable_ref = nullptr;
 	if ( current_token == tok_leftBracket )
 		variable_ref = std::move(parseArrayReference(var_name));
 	else
-		variable_ref = std::make_unique<ASTSingleVarReference>(var_name);
+		variable_ref = makeNode<ASTSingleVarReference>("SingleVarReference", var_name);
 
 	validateToken(tok_assign); getNextToken();
 
 	auto new_value = parseExpression();
 
-	return std::make_unique<ASTAssignOp>(std::move(variable_ref), std::move(new_value));
+	return makeNode<ASTAssignOp>("AssignOp", std::move(variable_ref), std::move(new_value));
 }
 /**
  * [var_reference] ':=' expression
@@ -740,7 +854,7 @@ std::unique_ptr<ASTAssignOp> Parser::parseAssign(std::unique_ptr<ASTReference> v
 
 	auto new_value = parseExpression();
 
-	return std::make_unique<ASTAssignOp>(std::move(var_ref), std::move(new_value));
+	return makeNode<ASTAssignOp>("AssignOp", std::move(var_ref), std::move(new_value));
 }
 
 
@@ -754,7 +868,7 @@ std::unique_ptr<ASTAssignOp> Parser::parseAssign(std::unique_ptr<ASTReference> v
 	getNextToken();
 
 	validateToken(tok_identifier);
-	std::string procedure_name = lexan.getIdentifierStr();
+	std::string procedure_name = lexan -> getIdentifierStr();
 	getNextToken();
 
 	validateToken(tok_leftParenthesis);
@@ -764,7 +878,7 @@ std::unique_ptr<ASTAssignOp> Parser::parseAssign(std::unique_ptr<ASTReference> v
 
 	// Params
 	while ( current_token == tok_identifier ) {
-		std::string param_name = lexan.getIdentifierStr();
+		std::string param_name = lexan -> getIdentifierStr();
 		getNextToken();
 
 		validateToken(tok_colon);
@@ -772,7 +886,7 @@ std::unique_ptr<ASTAssignOp> Parser::parseAssign(std::unique_ptr<ASTReference> v
 
 		auto type = parseVarType();
 
-		params.emplace_back(std::make_unique<ASTVariable>(param_name, type));
+		params.emplace_back(makeNode<ASTVariable>("Variable", param_name, type));
 
 		if ( current_token != tok_semicolon )
 			break;
@@ -787,7 +901,7 @@ std::unique_ptr<ASTAssignOp> Parser::parseAssign(std::unique_ptr<ASTReference> v
 	validateToken(tok_semicolon);
 	getNextToken();
 
-	return std::make_unique<ASTProcedurePrototype>(procedure_name, std::move(params));
+	return makeNode<ASTProcedurePrototype>("ProcedurePrototype", procedure_name, std::move(params));
 }*/
 
 /** [procedure_proto] {'forward' ';'}
@@ -806,7 +920,7 @@ std::unique_ptr<ASTAssignOp> Parser::parseAssign(std::unique_ptr<ASTReference> v
 		validateToken(tok_semicolon);
 		getNextToken();
 
-		return std::make_unique<ASTProcedure>(std::move(prototype), std::move(local), nullptr);
+		return makeNode<ASTProcedure>("Procedure", std::move(prototype), std::move(local), nullptr);
 	}
 
 	// Parse local variable declarations
@@ -828,7 +942,7 @@ std::unique_ptr<ASTAssignOp> Parser::parseAssign(std::unique_ptr<ASTReference> v
 	validateToken(tok_semicolon);
 	getNextToken();
 
-	return std::make_unique<ASTProcedure>(std::move(prototype), std::move(local), std::move(body));
+	return makeNode<ASTProcedure>("Procedure", std::move(prototype), std::move(local), std::move(body));
 }*/
 
 /* #############################PRIVATE############################# */
@@ -838,7 +952,38 @@ std::unique_ptr<ASTAssignOp> Parser::parseAssign(std::unique_ptr<ASTReference> v
  */
 Token Parser::getNextToken ()
 {
-	return current_token = lexan.getToken();
+	// Directives may appear between any two tokens
+	while ( readToken() == tok_directive )
+		applyDirective(lexan -> getIdentifierStr());
+	return current_token;
+}
+
+/**
+ * Applies the comma separated switches of a directive, e.g. {$R+} or {$R-, Q+}.
+ * Only {$R} is supported, every other switch is reported as ignored.
+ */
+void Parser::applyDirective(const std::string & directive)
+{
+	static const char * const blanks = " \t\r\n";
+	for ( size_t start = 0; start <= directive.size(); ) {
+		size_t end = std::min(directive.find(',', start), directive.size());
+		std::string item = directive.substr(start, end - start);
+		start = end + 1;
+
+		size_t first = item.find_first_not_of(blanks);
+		if ( first == std::string::npos )
+			continue;
+		item = item.substr(first, item.find_last_not_of(blanks) - first + 1);
+		if ( item.size() == 2 && (item[0] == 'R' || item[0] == 'r') && (item[1] == '+' || item[1] == '-') )
+			range_checks = item[1] == '+';
+		else if ( warnings )
+			warnings -> push_back("Ignored directive switch " + item);
+	}
+}
+
+Token Parser::readToken ()
+{
+	return current_token = lexan -> getToken();
 }
 /**
  * Return token precedence if its binary operator
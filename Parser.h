@@ -2,21 +2,71 @@
 // Created by matous on 5.5.19.
 //
 #include "AbstractSyntaxTree.h"
+#include "Report.h"
 
+#include <exception>
 #include <iostream>
 #include <map>
 #include <string>
 #include <memory>
+#include <vector>
 
 
 #define _DEBUG_PARSER_
 
+/**
+ * Lexes ahead in batches of tokens and adds the time of each batch to the Lexing phase,
+ * timing every token would mostly measure the clock. A lexer error is raised when the
+ * parser reaches it, after the tokens before it.
+ */
+class TimedTokenSource : public TokenSource
+{
+public:
+	TimedTokenSource(std::unique_ptr<TokenSource> source, CompileReport & report)
+		: source(std::move(source)), report(report) {}
+
+	std::string getIdentifierStr() override { return identifier_str; }
+	int getNumVal() override { return num_val; }
+	std::string getStringVal() override { return string_val; }
+	Token getToken() override;
+
+private:
+	struct Entry
+	{
+		Token token;
+		int num_val;
+		std::string text;
+	};
+	void lexBatch();
+
+	static const size_t batch_size = 256;
+
+	std::unique_ptr<TokenSource> source;
+	CompileReport & report;
+	std::vector<Entry> batch;
+	size_t position = 0;
+	std::exception_ptr error;   // raised after the batch
+	bool lexed_eof = false, finished = false;
+	std::string identifier_str, string_val;
+	int num_val = 0;
+};
+
 class Parser
 {
 public:
 	Parser(const std::string & file_name);
+	// Parses tokens produced elsewhere, e.g. by a lexer on another thread
+	Parser(std::unique_ptr<TokenSource> tokens);
+	// Collect lexing time, token and AST node counts into report
+	void setReport(CompileReport * report);
+	// Range checking before the first {$R+} or {$R-}
+	void setRangeChecks(bool enabled) { range_checks = enabled; }
+	// Directive switches the parser ignores are reported to warnings, when set
+	void setWarnings(std::vector<std::string> * sink) { warnings = sink; }
 
 	std::unique_ptr<ASTProgram> start();
+	// Hands the parts of the program to consumer as soon as each one is parsed
+	void parse(ASTConsumer & consumer);
 
 	std::unique_ptr<ASTExpression> parseExpression();
 	std::unique_ptr<ASTExpression> parseStatement();
@@ -60,11 +110,26 @@ public:
 	std::unique_ptr<ASTAssignOp> parseAssign(std::unique_ptr<ASTReference> var_ref);
 
 private:
-	Lexan lexan;
+	std::unique_ptr<TokenSource> lexan;
+	CompileReport * report = nullptr;
+	bool time_tokens = false;   // lexing is timed here only when this parser runs the lexer
+	bool range_checks = false;  // {$R+}, array references parsed now check their index
+	std::vector<std::string> * warnings = nullptr;
 	std::map<Token, int> bin_op_precedence;
 	Token current_token;
 	int getTokenPrecedence();
 	Token getNextToken();
+	Token readToken();
+	void applyDirective(const std::string & directive);
+
+	// Creates an AST node, counted by kind for --stats
+	template<typename Node, typename... Args>
+	std::unique_ptr<Node> makeNode(const char * kind, Args &&... args)
+	{
+		if ( report )
+			report -> countNode(kind);
+		return std::make_unique<Node>(std::forward<Args>(args)...);
+	}
 	bool validateToken (Token correct);
 
 	std::unique_ptr<ASTExpression> logError(const char * str) {
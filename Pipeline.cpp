@@ -0,0 +1,253 @@
+#include "Pipeline.h"
+
+#include <thread>
+
+#include "Trace.h"
+
+TokenRing::TokenRing() : slots(capacity), head(0), tail(0), closed(false), aborted(false) {}
+
+// Busy waiting is cheap while the other thread keeps up, yielding covers the rest
+static void backOff(unsigned & spins)
+{
+	if ( ++spins > 64 )
+		std::this_thread::yield();
+}
+
+bool TokenRing::push(Entry & entry)
+{
+	size_t position = tail.load(std::memory_order_relaxed);
+	unsigned spins = 0;
+	while ( position - head.load(std::memory_order_acquire) == capacity ) {
+		if ( closed.load(std::memory_order_relaxed) )
+			return false;
+		backOff(spins);
+	}
+
+	Entry & slot = slots[position & (capacity - 1)];
+	slot.token = entry.token;
+	slot.num_val = entry.num_val;
+	slot.text.swap(entry.text);
+	tail.store(position + 1, std::memory_order_release);
+	return !closed.load(std::memory_order_relaxed);
+}
+
+bool TokenRing::pop(Entry & entry)
+{
+	size_t position = head.load(std::memory_order_relaxed);
+	unsigned spins = 0;
+	while ( tail.load(std::memory_order_acquire) == position ) {
+		// Tokens pushed before the abort are still read
+		if ( aborted.load(std::memory_order_acquire) && tail.load(std::memory_order_acquire) == position )
+			return false;
+		backOff(spins);
+	}
+
+	Entry & slot = slots[position & (capacity - 1)];
+	entry.token = slot.token;
+	entry.num_val = slot.num_val;
+	entry.text.swap(slot.text);
+	head.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+void TokenRing::close()
+{
+	closed.store(true, std::memory_order_relaxed);
+}
+
+void TokenRing::abort()
+{
+	aborted.store(true, std::memory_order_release);
+}
+
+Token RingTokenSource::getToken()
+{
+	// The lexer stops after the end of file, which stays the current token
+	if ( finished )
+		return tok_eof;
+
+	// The lexer failed, its error is reported instead of the parser's
+	if ( !ring.pop(entry) ) {
+		finished = true;
+		return tok_error;
+	}
+	if ( entry.token == tok_identifier || entry.token >= tok_kwProgram )
+		identifier_str = entry.text;
+	else if ( entry.token == tok_number )
+		num_val = entry.num_val;
+	else if ( entry.token == tok_string )
+		string_val = entry.text;
+
+	finished = entry.token == tok_eof;
+	return entry.token;
+}
+
+void ASTQueue::push(Item item)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	changed.wait(lock, [this] { return cancelled || items.size() < capacity; });
+	if ( cancelled )
+		throw "Compilation cancelled";
+	items.push_back(std::move(item));
+	changed.notify_all();
+}
+
+void ASTQueue::startProgram(const std::string & name)
+{
+	Item item{Item::program};
+	item.name = name;
+	push(std::move(item));
+}
+
+void ASTQueue::addGlobal(std::unique_ptr<ASTVariableDef> global)
+{
+	Item item{Item::global};
+	item.global_def = std::move(global);
+	push(std::move(item));
+}
+
+void ASTQueue::addFunction(std::unique_ptr<ASTFunction> function)
+{
+	Item item{Item::function};
+	item.function_def = std::move(function);
+	push(std::move(item));
+}
+
+void ASTQueue::finishProgram(std::unique_ptr<ASTBody> main)
+{
+	Item item{Item::main};
+	item.main_body = std::move(main);
+	push(std::move(item));
+}
+
+void ASTQueue::fail(std::exception_ptr error)
+{
+	// Errors bypass the size limit, the generator may be gone already
+	std::lock_guard<std::mutex> lock(mutex);
+	Item item{Item::error};
+	item.failure = error;
+	items.push_back(std::move(item));
+	changed.notify_all();
+}
+
+void ASTQueue::cancel()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	cancelled = true;
+	changed.notify_all();
+}
+
+void ASTQueue::replay(ASTConsumer & consumer)
+{
+	while ( true ) {
+		Item item;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this] { return !items.empty(); });
+			item = std::move(items.front());
+			items.pop_front();
+			changed.notify_all();
+		}
+
+		switch ( item.kind ) {
+			case Item::program:
+				consumer.startProgram(item.name);
+				break;
+			case Item::global:
+				consumer.addGlobal(std::move(item.global_def));
+				break;
+			case Item::function:
+				consumer.addFunction(std::move(item.function_def));
+				break;
+			case Item::main:
+				consumer.finishProgram(std::move(item.main_body));
+				return;
+			case Item::error:
+				std::rethrow_exception(item.failure);
+		}
+	}
+}
+
+std::unique_ptr<Module> generatePipelined(const CompileOptions & options, CompileReport * report,
+                                          std::vector<std::string> & warnings)
+{
+	TokenRing ring;
+	ASTQueue queue;
+
+	// The threads measure into their own reports, merged after they are joined
+	CompileReport lexer_report, parser_report;
+	if ( report ) {
+		report -> addTime("Lexing", 0, 0);
+		report -> addTime("Parsing", 0, 0);
+	}
+
+	std::exception_ptr lexer_error;
+	std::thread lexer_thread([&] {
+		TraceScope scope("phase", "Lexing");
+		auto start = CompileReport::now();
+		try {
+			Lexan lexan(options.input_file);
+			TokenRing::Entry entry;
+			do {
+				entry.token = lexan.getToken();
+				if ( entry.token == tok_identifier || entry.token >= tok_kwProgram )
+					entry.text = lexan.getIdentifierStr();
+				else if ( entry.token == tok_number )
+					entry.num_val = lexan.getNumVal();
+				else if ( entry.token == tok_string )
+					entry.text = lexan.getStringVal();
+				lexer_report.tokens++;
+			} while ( ring.push(entry) && entry.token != tok_eof );
+		} catch (...) {
+			lexer_error = std::current_exception();
+			ring.abort();
+		}
+		lexer_report.addTime("Lexing", start);
+	});
+
+	std::thread parser_thread([&] {
+		TraceScope scope("phase", "Parsing");
+		auto start = CompileReport::now();
+		try {
+			Parser parser(std::make_unique<RingTokenSource>(ring));
+			parser.setReport(report ? &parser_report : nullptr);
+			parser.setRangeChecks(options.range_checks);
+			parser.setWarnings(&warnings);
+			parser.parse(queue);
+		} catch (...) {
+			queue.fail(std::current_exception());
+		}
+		ring.close();
+		parser_report.addTime("Parsing", start);
+	});
+
+	std::unique_ptr<Module> module;
+	try {
+		StreamingCodegen generator(options, report);
+		queue.replay(generator);
+		module = generator.takeModule();
+	} catch (...) {
+		queue.cancel();
+		parser_thread.join();
+		lexer_thread.join();
+		// A lexer failure shows up as a parse error, the original error says more
+		if ( lexer_error )
+			std::rethrow_exception(lexer_error);
+		throw;
+	}
+	parser_thread.join();
+	lexer_thread.join();
+
+	if ( report ) {
+		auto lexing = lexer_report.findPhase("Lexing");
+		auto parsing = parser_report.findPhase("Parsing");
+		report -> addTime("Lexing", lexing -> wall, lexing -> cpu);
+		report -> addTime("Parsing", parsing -> wall, parsing -> cpu);
+		report -> notePeakMemory("Lexing");
+		report -> notePeakMemory("Parsing");
+		report -> tokens += lexer_report.tokens;
+		for ( auto & kind : parser_report.ast_nodes )
+			report -> ast_nodes[kind.first] += kind.second;
+	}
+	return module;
+}
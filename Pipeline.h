@@ -0,0 +1,120 @@
+#ifndef PAS_COMPILER_PIPELINE_H
+#define PAS_COMPILER_PIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+#include "Parser.h"
+
+/**
+ * Lock-free ring buffer passing tokens from the lexer thread to the parser thread.
+ * Exactly one thread pushes and one thread pops. A slot is filled before the tail index
+ * publishing it is stored (release) and read after the index is loaded (acquire).
+ */
+class TokenRing
+{
+public:
+	struct Entry
+	{
+		Token token;
+		int num_val;
+		std::string text;   // identifier or keyword spelling, or string literal
+	};
+
+	TokenRing();
+
+	// Producer side, waits while the ring is full, false once the consumer closed it
+	bool push(Entry & entry);
+	// Consumer side, waits while the ring is empty, false once the producer aborted
+	bool pop(Entry & entry);
+	// Consumer side, tells the producer to stop
+	void close();
+	// Producer side, ends the stream early after an error
+	void abort();
+
+private:
+	static const size_t capacity = 4096;   // power of two
+
+	std::vector<Entry> slots;
+	alignas(64) std::atomic<size_t> head;  // next slot to pop, written by the consumer
+	alignas(64) std::atomic<size_t> tail;  // next slot to push, written by the producer
+	std::atomic<bool> closed;
+	std::atomic<bool> aborted;
+};
+
+// Feeds the parser from a TokenRing, keeping the last value of every kind like Lexan does
+class RingTokenSource : public TokenSource
+{
+public:
+	explicit RingTokenSource(TokenRing & ring) : ring(ring) {}
+
+	std::string getIdentifierStr() override { return identifier_str; }
+	int getNumVal() override { return num_val; }
+	std::string getStringVal() override { return string_val; }
+	Token getToken() override;
+
+private:
+	TokenRing & ring;
+	TokenRing::Entry entry;
+	bool finished = false;
+	std::string identifier_str;
+	int num_val = 0;
+	std::string string_val;
+};
+
+/**
+ * Bounded queue passing parsed declarations from the parser thread to the code generating thread.
+ * Acts as the consumer of the parser and replays everything to the real consumer on the other side.
+ */
+class ASTQueue : public ASTConsumer
+{
+public:
+	void startProgram(const std::string & name) override;
+	void addGlobal(std::unique_ptr<ASTVariableDef> global) override;
+	void addFunction(std::unique_ptr<ASTFunction> function) override;
+	void finishProgram(std::unique_ptr<ASTBody> main) override;
+
+	// Parser side, ends the queue with the error the parser failed with
+	void fail(std::exception_ptr error);
+	// Generator side, hands over everything up to the main body, rethrows an error of the parser
+	void replay(ASTConsumer & consumer);
+	// Generator side, makes the parser stop at its next declaration
+	void cancel();
+
+private:
+	struct Item
+	{
+		enum Kind { program, global, function, main, error } kind;
+		std::string name;
+		std::unique_ptr<ASTVariableDef> global_def;
+		std::unique_ptr<ASTFunction> function_def;
+		std::unique_ptr<ASTBody> main_body;
+		std::exception_ptr failure;
+	};
+
+	// Limits the AST held between the threads
+	static const size_t capacity = 64;
+
+	void push(Item item);
+
+	std::deque<Item> items;
+	std::mutex mutex;
+	std::condition_variable changed;
+	bool cancelled = false;
+};
+
+/**
+ * Compiles a program on three threads: the lexer and the parser run on their own threads,
+ * code generation on the calling thread, whose context then owns the module.
+ * @param report receives the phase times and counts, may be null
+ * @param warnings receives the warnings of the parser, also when an error is thrown
+ * @throw the errors of the lexer, parser and code generation
+ */
+std::unique_ptr<Module> generatePipelined(const CompileOptions & options, CompileReport * report,
+                                          std::vector<std::string> & warnings);
+
+#endif //PAS_COMPILER_PIPELINE_H
@@ -0,0 +1,193 @@
+#include "Report.h"
+
+#include <chrono>
+#include <ctime>
+#include <sys/resource.h>
+
+#include "llvm/Support/Format.h"
+
+#include "Trace.h"
+
+using namespace llvm;
+
+CompileReport::Timestamp CompileReport::now()
+{
+	timespec cpu;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	auto wall = std::chrono::steady_clock::now().time_since_epoch();
+
+	return {std::chrono::duration<double>(wall).count(), cpu.tv_sec + cpu.tv_nsec / 1e9};
+}
+
+void CompileReport::addTime(const std::string & phase, const Timestamp & start)
+{
+	Timestamp end = now();
+	addTime(phase, end.wall - start.wall, end.cpu - start.cpu);
+}
+
+void CompileReport::addTime(const std::string & phase, double wall, double cpu)
+{
+	Phase * entry = nullptr;
+	for ( auto & existing : phases )
+		if ( existing.name == phase )
+			entry = &existing;
+	if ( !entry ) {
+		phases.emplace_back();
+		entry = &phases.back();
+		entry -> name = phase;
+	}
+	entry -> wall += wall;
+	entry -> cpu += cpu;
+}
+
+void CompileReport::notePeakMemory(const std::string & phase)
+{
+	// ru_maxrss is in KiB on Linux
+	rusage usage;
+	for ( auto & entry : phases )
+		if ( entry.name == phase && !getrusage(RUSAGE_SELF, &usage) )
+			entry.peak_memory = usage.ru_maxrss;
+}
+
+const CompileReport::Phase * CompileReport::findPhase(const std::string & phase) const
+{
+	for ( auto & entry : phases )
+		if ( entry.name == phase )
+			return &entry;
+	return nullptr;
+}
+
+CompileReport::Timestamp CompileReport::measured() const
+{
+	Timestamp sum = {0, 0};
+	for ( auto & phase : phases ) {
+		sum.wall += phase.wall;
+		sum.cpu += phase.cpu;
+	}
+	return sum;
+}
+
+void CompileReport::countIR(const Module & module)
+{
+	for ( auto & function : module ) {
+		if ( function.isDeclaration() )
+			continue;
+		functions++;
+		for ( auto & block : function ) {
+			basic_blocks++;
+			instructions += block.size();
+		}
+	}
+}
+
+void CompileReport::printTimes(raw_ostream & out) const
+{
+	out << "Time report for " << file << "\n";
+	out << "   Wall (s)     CPU (s)  Peak RSS (KiB)  Phase\n";
+	double total_wall = 0, total_cpu = 0;
+	for ( auto & phase : phases ) {
+		out << format("%11.6f %11.6f %15llu  ", phase.wall, phase.cpu, (unsigned long long) phase.peak_memory) << phase.name << "\n";
+		total_wall += phase.wall;
+		total_cpu += phase.cpu;
+	}
+	out << format("%11.6f %11.6f %15s  ", total_wall, total_cpu, (const char *) "") << "Total\n";
+}
+
+void CompileReport::printStats(raw_ostream & out) const
+{
+	out << "Statistics for " << file << "\n";
+	out << format("%10llu  ", (unsigned long long) tokens) << "tokens\n";
+	uint64_t nodes = 0;
+	for ( auto & kind : ast_nodes )
+		nodes += kind.second;
+	out << format("%10llu  ", (unsigned long long) nodes) << "AST nodes\n";
+	for ( auto & kind : ast_nodes )
+		out << format("%10llu  ", (unsigned long long) kind.second) << "  " << kind.first << "\n";
+	out << format("%10llu  ", (unsigned long long) functions) << "IR functions\n";
+	out << format("%10llu  ", (unsigned long long) basic_blocks) << "IR basic blocks\n";
+	uint64_t routine_count = 0;
+	for ( auto & kind : routines )
+		routine_count += kind.second;
+	out << format("%10llu  ", (unsigned long long) routine_count) << "routines\n";
+	for ( auto & kind : routines )
+		out << format("%10llu  ", (unsigned long long) kind.second) << "  " << kind.first << "\n";
+	out << format("%10llu  ", (unsigned long long) hoisted_calls) << "hoisted calls\n";
+	out << format("%10llu  ", (unsigned long long) evaluated_calls) << "calls evaluated at compile time\n";
+	out << format("%10llu  ", (unsigned long long) instructions) << "IR instructions\n";
+}
+
+void writeJSONString(raw_ostream & out, const std::string & value)
+{
+	out << '"';
+	for ( unsigned char c : value ) {
+		if ( c == '"' || c == '\\' )
+			out << '\\' << c;
+		else if ( c < 0x20 )
+			out << format("\\u%04x", c);
+		else
+			out << c;
+	}
+	out << '"';
+}
+
+void CompileReport::printJSON(raw_ostream & out, bool times, bool stats) const
+{
+	out << "{\"file\":";
+	writeJSONString(out, file);
+
+	if ( times ) {
+		out << ",\"time_report\":[";
+		for ( size_t i = 0; i < phases.size(); i++ ) {
+			out << (i ? "," : "") << "{\"phase\":";
+			writeJSONString(out, phases[i].name);
+			out << format(",\"wall\":%.9f,\"cpu\":%.9f,", phases[i].wall, phases[i].cpu)
+			    << "\"peak_memory_kib\":" << phases[i].peak_memory << "}";
+		}
+		out << "]";
+	}
+
+	if ( stats ) {
+		out << ",\"stats\":{\"tokens\":" << tokens << ",\"ast_nodes\":{";
+		bool first = true;
+		for ( auto & kind : ast_nodes ) {
+			out << (first ? "" : ",");
+			writeJSONString(out, kind.first);
+			out << ":" << kind.second;
+			first = false;
+		}
+		out << "},\"routines\":{";
+		first = true;
+		for ( auto & kind : routines ) {
+			out << (first ? "" : ",");
+			writeJSONString(out, kind.first);
+			out << ":" << kind.second;
+			first = false;
+		}
+		out << "},\"hoisted_calls\":" << hoisted_calls << ",\"evaluated_calls\":" << evaluated_calls;
+		out << ",\"functions\":" << functions << ",\"basic_blocks\":" << basic_blocks
+		    << ",\"instructions\":" << instructions << "}";
+	}
+
+	out << "}\n";
+}
+
+PhaseTimer::PhaseTimer(CompileReport * report, const char * phase)
+	: report(report), phase(phase), traced(tracingEnabled())
+{
+	if ( report )
+		start = CompileReport::now();
+	if ( traced )
+		traceBegin("phase", phase);
+}
+
+void PhaseTimer::stop()
+{
+	if ( report ) {
+		report -> addTime(phase, start);
+		report -> notePeakMemory(phase);
+	}
+	if ( traced )
+		traceEnd("phase", phase);
+	report = nullptr;
+	traced = false;
+}
@@ -0,0 +1,88 @@
+#ifndef PAS_COMPILER_REPORT_H
+#define PAS_COMPILER_REPORT_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+/**
+ * Measurements of one compilation for --time-report and --stats.
+ * Phases are timed by the thread compiling, so the CPU time stays correct when
+ * several inputs are compiled in parallel. Peak memory is the peak resident set
+ * of the whole process at the end of the phase.
+ */
+class CompileReport
+{
+public:
+	struct Phase
+	{
+		std::string name;
+		double wall = 0;        // seconds
+		double cpu = 0;         // seconds
+		uint64_t peak_memory = 0; // KiB
+	};
+
+	// Point in time of the wall and the thread CPU clock
+	struct Timestamp
+	{
+		double wall;
+		double cpu;
+	};
+
+	static Timestamp now();
+	// Adds the time since start to the phase, repeated phases accumulate
+	void addTime(const std::string & phase, const Timestamp & start);
+	void addTime(const std::string & phase, double wall, double cpu);
+	// Sets the peak memory of phase to the current peak of the process, at the end of the phase
+	void notePeakMemory(const std::string & phase);
+	const Phase * findPhase(const std::string & phase) const;
+	// Sum of all phases measured so far
+	Timestamp measured() const;
+
+	void countNode(const char * kind) { ast_nodes[kind]++; }
+	// Counts the functions, blocks and instructions of the final IR
+	void countIR(const llvm::Module & module);
+
+	void printTimes(llvm::raw_ostream & out) const;
+	void printStats(llvm::raw_ostream & out) const;
+	// One line JSON object with the requested sections
+	void printJSON(llvm::raw_ostream & out, bool times, bool stats) const;
+
+	std::string file;
+	uint64_t tokens = 0;
+	std::map<std::string, uint64_t> ast_nodes;
+	uint64_t functions = 0;
+	uint64_t basic_blocks = 0;
+	uint64_t instructions = 0;
+	std::map<std::string, uint64_t> routines;  // by their side effects
+	uint64_t hoisted_calls = 0;                // loop invariant calls moved out of while conditions
+	uint64_t evaluated_calls = 0;              // calls of pure functions replaced by their result
+
+private:
+	std::vector<Phase> phases;
+};
+
+// Writes value as a JSON string literal
+void writeJSONString(llvm::raw_ostream & out, const std::string & value);
+
+// Times a phase until destroyed and traces it with --trace, does nothing without either
+class PhaseTimer
+{
+public:
+	PhaseTimer(CompileReport * report, const char * phase);
+	~PhaseTimer() { stop(); }
+	// Ends the phase before the end of the scope
+	void stop();
+
+private:
+	CompileReport * report;
+	const char * phase;
+	CompileReport::Timestamp start;
+	bool traced;
+};
+
+#endif //PAS_COMPILER_REPORT_H
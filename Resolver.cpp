@@ -0,0 +1,380 @@
+#include "AbstractSyntaxTree.h"
+#include "Resolver.h"
+
+// Variables are held in memory by the interpreter, larger ones are refused
+static const uint64_t max_variable_size = 1 << 28;
+
+// Whether reference names a whole array variable rather than an element or an integer
+static bool isWholeArray(ASTReference & reference)
+{
+	return dynamic_cast<ASTSingleVarReference *>(&reference) && reference.slot.array;
+}
+
+const VariableSlot * Resolver::find(const std::string & name) const
+{
+	auto constant = constants.find(name);
+	if ( constant != constants.end() )
+		return &constant -> second;
+	return findVariable(name);
+}
+
+const VariableSlot * Resolver::findVariable(const std::string & name) const
+{
+	auto local = locals.find(name);
+	if ( local != locals.end() )
+		return &local -> second;
+	auto global = globals.find(name);
+	if ( global != globals.end() )
+		return &global -> second;
+	return nullptr;
+}
+
+unsigned Resolver::findRoutine(const std::string & name)
+{
+	auto routine = routine_indices.find(name);
+	if ( routine == routine_indices.end() )
+		throw "Unknown function referenced: " + name;
+	routines[routine -> second].called = true;
+	return routine -> second;
+}
+
+void Resolver::checkAssignable(const std::string & name) const
+{
+	if ( const_parameters.count(name) )
+		throw "Assignment to const parameter " + name;
+	if ( control_variables.count(name) )
+		throw "Assignment to for loop control variable " + name;
+}
+
+// Size and bounds of a variable of type, without its place
+VariableSlot Resolver::layout(ASTVariableType & type)
+{
+	VariableSlot slot;
+	auto array = dynamic_cast<ASTArray *>(&type);
+	if ( !array )
+		return slot;
+
+	if ( dynamic_cast<ASTArray *>(array -> type.get()) )
+		throw std::string("Arrays of arrays are not supported by the interpreter");
+	evaluator.resolveBounds(*array);
+	uint64_t size = (uint64_t) ((int64_t) array -> upper - array -> lower + 1);
+	if ( size > max_variable_size )
+		throw "Array of " + std::to_string(size) + " integers is too large for the interpreter";
+	slot.array = true;
+	slot.lower_bound = array -> lower;
+	slot.size = size;
+	return slot;
+}
+
+void Resolver::declareGlobal(ASTVariableDef & global)
+{
+	if ( auto constant = dynamic_cast<ASTConstVariable *>(&global) ) {
+		VariableSlot slot;
+		slot.index = evaluator.require(*constant -> value, "Constant " + constant -> name);
+		evaluator.addConstant(constant -> name, slot.index);
+		constants[constant -> name] = slot;
+		return;
+	}
+
+	auto & variable = static_cast<ASTVariable &>(global);
+	VariableSlot slot = layout(*variable.type);
+	slot.kind = VariableSlot::global;
+	slot.index = global_size;
+	if ( global_size + (uint64_t) slot.size > max_variable_size )
+		throw std::string("The global variables are too large for the interpreter");
+	global_size += slot.size;
+	globals[variable.name] = slot;
+}
+
+// Pure routines can be run by the evaluator, so constant expressions can call them
+void Resolver::addConstantRoutine(ASTFunction & function)
+{
+	const RoutineEffects * summary = effects.find(function.getName());
+	if ( summary && summary -> purity == Purity::pure )
+		evaluator.addRoutine(function);
+}
+
+unsigned Resolver::declareRoutine(ASTFunction & function)
+{
+	auto inserted = routine_indices.emplace(function.getName(), routines.size());
+	if ( inserted.second ) {
+		routines.emplace_back();
+		routines.back().name = function.getName();
+	}
+	ResolvedRoutine & routine = routines[inserted.first -> second];
+
+	routine.parameters.clear();
+	routine.frame_size = 0;
+	routine.references = 0;
+	for ( auto & parameter : function.prototype -> parameters ) {
+		ParameterSlot resolved;
+		resolved.name = parameter -> name;
+		resolved.slot = layout(*parameter -> type);
+		resolved.var = parameter -> mode == ASTParameter::var;
+		if ( parameter -> mode == ASTParameter::var || (resolved.slot.array && parameter -> mode == ASTParameter::constant) ) {
+			resolved.slot.kind = VariableSlot::reference;
+			resolved.slot.index = routine.references++;
+		} else {
+			resolved.slot.kind = VariableSlot::local;
+			resolved.slot.index = routine.frame_size;
+			resolved.copied = resolved.slot.array;
+			routine.frame_size += resolved.slot.size;
+		}
+		routine.parameters.push_back(resolved);
+	}
+	return inserted.first -> second;
+}
+
+void Resolver::resolveRoutine(ASTFunction & function)
+{
+	unsigned index = declareRoutine(function);
+	if ( !function.body )
+		return;
+
+	ResolvedRoutine & routine = routines[index];
+	routine.function = &function;
+	locals.clear();
+	const_parameters.clear();
+	for ( size_t i = 0; i < routine.parameters.size(); i++ ) {
+		ASTParameter & parameter = *function.prototype -> parameters[i];
+		locals[parameter.name] = routine.parameters[i].slot;
+		if ( parameter.mode == ASTParameter::constant )
+			const_parameters.insert(parameter.name);
+	}
+
+	auto addLocal = [&](const std::string & name, ASTVariableType & type) {
+		VariableSlot slot = layout(type);
+		slot.kind = VariableSlot::local;
+		slot.index = routine.frame_size;
+		if ( routine.frame_size + (uint64_t) slot.size > max_variable_size )
+			throw "The variables of " + routine.name + " are too large for the interpreter";
+		routine.frame_size += slot.size;
+		locals[name] = slot;
+		return slot.index;
+	};
+	for ( auto & local : function.local_variables )
+		addLocal(local -> name, *local -> type);
+	if ( function.prototype -> returnType ) {
+		if ( dynamic_cast<ASTArray *>(function.prototype -> returnType.get()) )
+			throw "Function " + routine.name + " returns an array, which the interpreter doesn't support";
+		routine.result = addLocal(routine.name, *function.prototype -> returnType);
+	}
+
+	// Self calls in tail position restart the routine
+	function.body -> markTailCalls(*function.prototype, true);
+	current = &routine;
+	function.body -> resolve(*this);
+	current = nullptr;
+	locals.clear();
+	const_parameters.clear();
+}
+
+void Resolver::resolveProgram(ASTProgram & program)
+{
+	for ( auto & global : program.global )
+		if ( auto variable = dynamic_cast<ASTVariable *>(global.get()) )
+			effects.addGlobal(variable -> name);
+	for ( auto & function : program.functions )
+		effects.addRoutine(*function);
+	effects.analyze();
+
+	// Constant expressions can only call the routines declared before them, as in codegen
+	size_t declared = 0;
+	for ( size_t i = 0; i < program.global.size(); i++ ) {
+		for ( ; i < program.routines_before.size() && declared < program.routines_before[i]; declared++ )
+			addConstantRoutine(*program.functions[declared]);
+		declareGlobal(*program.global[i]);
+	}
+	for ( ; declared < program.functions.size(); declared++ )
+		addConstantRoutine(*program.functions[declared]);
+
+	// A routine can call the routines declared before it and itself
+	for ( auto & function : program.functions )
+		resolveRoutine(*function);
+	program.main -> resolve(*this);
+
+	for ( auto & routine : routines )
+		if ( routine.called && !routine.function )
+			throw "Routine " + routine.name + " is declared forward but never defined";
+}
+
+void ASTBody::resolve(Resolver & resolver)
+{
+	for ( auto & statement : content )
+		statement -> resolve(resolver);
+}
+
+void ASTString::resolve(Resolver &)
+{
+	throw std::string("Strings can only be written");
+}
+
+void ASTIf::resolve(Resolver & resolver)
+{
+	condition -> resolve(resolver);
+	then_body -> resolve(resolver);
+	if ( else_body )
+		else_body -> resolve(resolver);
+}
+
+void ASTFor::resolve(Resolver & resolver)
+{
+	const VariableSlot * variable = resolver.findVariable(variable_name);
+	if ( !variable )
+		throw "Using an undeclared variable in for statement";
+	if ( variable -> array )
+		throw "Array " + variable_name + " used as a control variable";
+	resolver.checkAssignable(variable_name);
+	control = *variable;
+
+	start -> resolve(resolver);
+	end -> resolve(resolver);
+
+	resolver.control_variables.insert(variable_name);
+	resolver.loop_depth++;
+	body -> resolve(resolver);
+	resolver.loop_depth--;
+	resolver.control_variables.erase(variable_name);
+}
+
+void ASTWhile::resolve(Resolver & resolver)
+{
+	condition -> resolve(resolver);
+
+	resolver.loop_depth++;
+	body -> resolve(resolver);
+	resolver.loop_depth--;
+}
+
+void ASTBreak::resolve(Resolver & resolver)
+{
+	if ( !resolver.loop_depth )
+		throw "break outside of a loop";
+}
+
+void ASTContinue::resolve(Resolver & resolver)
+{
+	if ( !resolver.loop_depth )
+		throw "continue outside of a loop";
+}
+
+void ASTSingleVarReference::resolveAddress(Resolver & resolver)
+{
+	const VariableSlot * variable = resolver.findVariable(name);
+	if ( !variable )
+		throw "Using an undeclared variable " + name;
+	slot = *variable;
+}
+
+// Constants are found first, as in codegen
+void ASTSingleVarReference::resolve(Resolver & resolver)
+{
+	const VariableSlot * variable = resolver.find(name);
+	if ( !variable )
+		throw "Using an undeclared variable " + name;
+	if ( variable -> array )
+		throw "Array " + name + " used as a number";
+	slot = *variable;
+}
+
+void ASTArrayReference::resolveAddress(Resolver & resolver)
+{
+	const VariableSlot * variable = resolver.findVariable(name);
+	if ( !variable )
+		throw "Undeclared array variable";
+	if ( !variable -> array )
+		throw "Indexing " + name + ", which is not an array";
+	slot = *variable;
+	index -> resolve(resolver);
+}
+
+void ASTArrayReference::resolve(Resolver & resolver)
+{
+	resolveAddress(resolver);
+}
+
+void ASTAssignOp::resolve(Resolver & resolver)
+{
+	resolver.checkAssignable(variable -> name);
+	variable -> resolveAddress(resolver);
+	if ( !isWholeArray(*variable) ) {
+		value -> resolve(resolver);
+		return;
+	}
+
+	// Arrays of the same size are copied
+	auto source = dynamic_cast<ASTSingleVarReference *>(value.get());
+	if ( !source || !resolver.findVariable(source -> name) )
+		throw "Array " + variable -> name + " assigned a number";
+	source -> resolveAddress(resolver);
+	if ( !source -> slot.array || source -> slot.size != variable -> slot.size )
+		throw "Incompatible assignment to " + variable -> name;
+	copied = variable -> slot.size;
+}
+
+void ASTBinaryOperator::resolve(Resolver & resolver)
+{
+	LHS -> resolve(resolver);
+	RHS -> resolve(resolver);
+}
+
+void ASTFunctionCall::resolve(Resolver & resolver)
+{
+	if ( name == "writeln" || name == "write" ) {
+		callee = name == "writeln" ? Callee::writeln : Callee::write;
+		// Only the first argument is written, as in codegen
+		if ( !arguments.empty() && !dynamic_cast<ASTString *>(arguments[0].get()) )
+			arguments[0] -> resolve(resolver);
+		return;
+	}
+	if ( name == "readln" || name == "dec" ) {
+		callee = name == "readln" ? Callee::readln : Callee::dec;
+		if ( arguments.empty() )
+			return;
+		auto variable = dynamic_cast<ASTReference *>(arguments[0].get());
+		if ( !variable || !resolver.findVariable(variable -> name) )
+			throw "Variable expected as argument of " + name;
+		resolver.checkAssignable(variable -> name);
+		variable -> resolve(resolver);
+		return;
+	}
+
+	callee = Callee::routine;
+	routine_index = resolver.findRoutine(name);
+	const ResolvedRoutine & routine = resolver.routines[routine_index];
+	if ( routine.parameters.size() != arguments.size() )
+		throw "Incorrect number of arguments passed to " + name;
+
+	for ( size_t i = 0; i < arguments.size(); i++ ) {
+		const ParameterSlot & parameter = routine.parameters[i];
+		if ( parameter.slot.kind == VariableSlot::local && !parameter.copied ) {
+			arguments[i] -> resolve(resolver);
+			continue;
+		}
+
+		// Passed by address, var parameters need a variable that can be assigned
+		auto reference = dynamic_cast<ASTReference *>(arguments[i].get());
+		if ( !reference || !resolver.findVariable(reference -> name) )
+			throw (parameter.var ? "Variable expected as var argument of " : "Incompatible argument passed to ") + name;
+		if ( parameter.var )
+			resolver.checkAssignable(reference -> name);
+		reference -> resolveAddress(resolver);
+		bool array = isWholeArray(*reference);
+		if ( array != parameter.slot.array || (array && reference -> slot.size != parameter.slot.size) )
+			throw "Incompatible argument passed to " + name;
+	}
+
+	// The frame is reused when the arguments passed by address are the routine's own parameters
+	const ResolvedRoutine * current = resolver.currentRoutine();
+	reuses_frame = tail_call && current == &routine;
+	if ( !reuses_frame )
+		return;
+	for ( size_t i = 0; i < arguments.size(); i++ ) {
+		const ParameterSlot & parameter = routine.parameters[i];
+		if ( parameter.slot.kind == VariableSlot::local && !parameter.copied )
+			continue;
+		auto variable = dynamic_cast<ASTSingleVarReference *>(arguments[i].get());
+		if ( !variable || variable -> name != parameter.name )
+			reuses_frame = false;
+	}
+}
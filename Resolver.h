@@ -0,0 +1,105 @@
+#ifndef PAS_COMPILER_RESOLVER_H
+#define PAS_COMPILER_RESOLVER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Effects.h"
+#include "Evaluator.h"
+
+class ASTFunction;
+class ASTProgram;
+class ASTVariableDef;
+class ASTVariableType;
+
+// Where the interpreter keeps a variable
+struct VariableSlot
+{
+	enum Kind { constant, global, local, reference };
+	Kind kind = constant;
+	// Value of a constant, else the position among the globals, the routine's locals or its references
+	int index = 0;
+	bool array = false;
+	int lower_bound = 0;
+	// Integers taken, arrays are stored inline
+	unsigned size = 1;
+};
+
+// Parameter of a routine laid out for the interpreter
+struct ParameterSlot
+{
+	std::string name;
+	// A local for value parameters, a reference for var parameters and const arrays
+	VariableSlot slot;
+	// Value arrays are passed as a copy of the caller's array
+	bool copied = false;
+	// Declared var, const arrays are references as well but can't be assigned
+	bool var = false;
+};
+
+// Frame of a routine, the locals are integers and the references point into the caller's variables
+struct ResolvedRoutine
+{
+	std::string name;
+	ASTFunction * function = nullptr;  // the definition, null while only declared forward
+	std::vector<ParameterSlot> parameters;
+	unsigned frame_size = 0;           // integers taken by the value parameters, locals and the result
+	unsigned references = 0;
+	int result = -1;                   // local of a function's result
+	bool called = false;
+};
+
+/**
+ * Lays out the variables of a program for the interpreter and binds every name the program
+ * uses to a slot, so that nothing is looked up by name while it runs. Names are found as
+ * codegen finds them and the same errors are reported; constant expressions are evaluated
+ * by a ConstantEvaluator, which can call the pure routines declared before them.
+ */
+class Resolver
+{
+public:
+	/**
+	 * Resolves program, its nodes keep their slots
+	 * @throw std::string for errors in the program and what the interpreter doesn't support
+	 */
+	void resolveProgram(ASTProgram & program);
+
+	// Used by ASTExpression::resolve
+	// Constants first, then the routine's locals and the globals, null for undeclared names
+	const VariableSlot * find(const std::string & name) const;
+	// The same without constants, the names that can be assigned or passed by reference
+	const VariableSlot * findVariable(const std::string & name) const;
+	// @throw std::string when the routine isn't declared yet
+	unsigned findRoutine(const std::string & name);
+	// @throw std::string for const parameters and control variables of the enclosing for loops
+	void checkAssignable(const std::string & name) const;
+	// Routine being resolved, null in the main program
+	const ResolvedRoutine * currentRoutine() const { return current; }
+
+	unsigned loop_depth = 0;
+	std::set<std::string> control_variables;
+
+	unsigned global_size = 0;
+	std::vector<ResolvedRoutine> routines;
+	const std::map<std::string, VariableSlot> & globalSlots() const { return globals; }
+
+private:
+	VariableSlot layout(ASTVariableType & type);
+	void declareGlobal(ASTVariableDef & global);
+	void addConstantRoutine(ASTFunction & function);
+	// Registers the routine and lays out its parameters, a definition replaces a forward declaration
+	unsigned declareRoutine(ASTFunction & function);
+	void resolveRoutine(ASTFunction & function);
+
+	std::map<std::string, VariableSlot> constants, globals, locals;
+	std::set<std::string> const_parameters;
+	std::map<std::string, unsigned> routine_indices;
+	const ResolvedRoutine * current = nullptr;
+
+	EffectAnalysis effects;
+	ConstantEvaluator evaluator;
+};
+
+#endif //PAS_COMPILER_RESOLVER_H
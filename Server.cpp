@@ -0,0 +1,251 @@
+#include "Server.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Backend.h"
+#include "Driver.h"
+#include "WorkerPool.h"
+
+using namespace llvm;
+
+// Upper bound of a single message field, guards against garbage on the socket
+static const uint32_t max_field_size = 1 << 26;
+
+// Wire format: every integer is a native uint32_t, every string is its length followed by the bytes.
+// Request: field count, working directory, arguments. Reply: exit code, output.
+
+static bool writeAll(int fd, const void * data, size_t size)
+{
+	auto bytes = (const char *) data;
+	while ( size ) {
+		ssize_t written = write(fd, bytes, size);
+		if ( written < 0 && errno == EINTR )
+			continue;
+		if ( written <= 0 )
+			return false;
+		bytes += written;
+		size -= written;
+	}
+	return true;
+}
+
+static bool readAll(int fd, void * data, size_t size)
+{
+	auto bytes = (char *) data;
+	while ( size ) {
+		ssize_t got = read(fd, bytes, size);
+		if ( got < 0 && errno == EINTR )
+			continue;
+		if ( got <= 0 )
+			return false;
+		bytes += got;
+		size -= got;
+	}
+	return true;
+}
+
+static bool writeNumber(int fd, uint32_t value)
+{
+	return writeAll(fd, &value, sizeof(value));
+}
+
+static bool readNumber(int fd, uint32_t & value)
+{
+	return readAll(fd, &value, sizeof(value));
+}
+
+static bool writeString(int fd, const std::string & value)
+{
+	return writeNumber(fd, value.size()) && writeAll(fd, value.data(), value.size());
+}
+
+static bool readString(int fd, std::string & value)
+{
+	uint32_t size;
+	if ( !readNumber(fd, size) || size > max_field_size )
+		return false;
+	value.resize(size);
+	return readAll(fd, &value[0], size);
+}
+
+// Fills the socket address, false when the path doesn't fit
+static bool socketAddress(const std::string & socket_path, sockaddr_un & address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if ( socket_path.size() >= sizeof(address.sun_path) )
+		return false;
+	strcpy(address.sun_path, socket_path.c_str());
+	return true;
+}
+
+// Connected socket or -1
+static int connectTo(const std::string & socket_path)
+{
+	sockaddr_un address;
+	if ( !socketAddress(socket_path, address) )
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ( fd < 0 )
+		return -1;
+	if ( connect(fd, (sockaddr *) &address, sizeof(address)) ) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Relative paths of a request are relative to the client, not to the server
+static void makeAbsolute(const std::string & directory, std::string & path)
+{
+	if ( path.empty() )
+		return;
+	SmallString<256> absolute(path);
+	sys::fs::make_absolute(directory, absolute);
+	path = absolute.str().str();
+}
+
+// Compiles the command line of one request, the output is collected for the client
+static int compileRequest(const std::string & directory, const std::vector<std::string> & arguments, raw_ostream & out)
+{
+	std::vector<const char *> argv;
+	argv.push_back("pas_compiler");
+	for ( auto & argument : arguments )
+		argv.push_back(argument.c_str());
+
+	CompileOptions options;
+	std::string error;
+	if ( !parseOptions(argv.size(), argv.data(), options, error) ) {
+		out << error << "\n";
+		return 1;
+	}
+	// Running a program would use the server's own stdio, and its runtime errors would end the server
+	if ( options.jit || options.interpret || options.vm || options.tiered || !options.serve_socket.empty()
+	     || !options.trace_file.empty() ) {
+		out << "--jit, --interpret, --vm, --tiered, --serve and --trace can't be run by the compile server\n";
+		return 1;
+	}
+
+	for ( auto & input_file : options.input_files )
+		makeAbsolute(directory, input_file);
+	makeAbsolute(directory, options.input_file);
+	makeAbsolute(directory, options.output_file);
+	makeAbsolute(directory, options.cache_dir);
+
+	return compileInputs(options, out);
+}
+
+static void serveClient(int fd)
+{
+	uint32_t count;
+	std::string directory;
+	std::vector<std::string> arguments;
+	bool valid = readNumber(fd, count) && count > 0 && count < max_field_size && readString(fd, directory);
+	for ( uint32_t i = 1; valid && i < count; i++ ) {
+		arguments.emplace_back();
+		valid = readString(fd, arguments.back());
+	}
+
+	if ( valid ) {
+		std::string output;
+		raw_string_ostream out(output);
+		int exit_code = compileRequest(directory, arguments, out);
+		out.flush();
+		if ( writeNumber(fd, exit_code) )
+			writeString(fd, output);
+	}
+	close(fd);
+}
+
+int runServer(const std::string & socket_path, unsigned threads)
+{
+	sockaddr_un address;
+	if ( !socketAddress(socket_path, address) ) {
+		printf("Socket path too long: %s\n", socket_path.c_str());
+		return 1;
+	}
+
+	// A socket file nobody listens on is left over from a killed server
+	int running = connectTo(socket_path);
+	if ( running >= 0 ) {
+		close(running);
+		printf("A server is already listening on %s\n", socket_path.c_str());
+		return 1;
+	}
+	unlink(socket_path.c_str());
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ( listener < 0 || bind(listener, (sockaddr *) &address, sizeof(address)) || listen(listener, 64) ) {
+		printf("Could not listen on %s: %s\n", socket_path.c_str(), strerror(errno));
+		return 1;
+	}
+
+	// Clients going away must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+	initializeTargets();
+
+	WorkerPool pool(threads);
+	printf("Listening on %s\n", socket_path.c_str());
+	fflush(stdout);
+
+	while ( true ) {
+		int client = accept(listener, nullptr, nullptr);
+		if ( client < 0 ) {
+			if ( errno == EINTR || errno == ECONNABORTED )
+				continue;
+			printf("Accept failed: %s\n", strerror(errno));
+			break;
+		}
+		pool.async([client] { serveClient(client); });
+	}
+
+	close(listener);
+	unlink(socket_path.c_str());
+	return 1;
+}
+
+bool forwardToServer(const std::string & socket_path, int argc, const char * const argv[], int & exit_code)
+{
+	int fd = connectTo(socket_path);
+	if ( fd < 0 )
+		return false;
+
+	SmallString<256> directory;
+	sys::fs::current_path(directory);
+
+	// The server doesn't see the environment of the client
+	std::vector<std::string> arguments;
+	if ( getenv("PAS_CACHE_DIR") )
+		arguments.push_back(std::string("--cache-dir=") + getenv("PAS_CACHE_DIR"));
+	for ( int i = 1; i < argc; i++ )
+		arguments.push_back(argv[i]);
+
+	bool sent = writeNumber(fd, arguments.size() + 1) && writeString(fd, directory.str().str());
+	for ( size_t i = 0; sent && i < arguments.size(); i++ )
+		sent = writeString(fd, arguments[i]);
+
+	uint32_t code;
+	std::string output;
+	bool answered = sent && readNumber(fd, code) && readString(fd, output);
+	close(fd);
+	if ( !answered )
+		return false;
+
+	fwrite(output.data(), 1, output.size(), stdout);
+	exit_code = code;
+	return true;
+}
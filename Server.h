@@ -0,0 +1,23 @@
+#ifndef PAS_COMPILER_SERVER_H
+#define PAS_COMPILER_SERVER_H
+
+#include <string>
+
+/**
+ * Serves compile requests on a Unix domain socket until the process is killed.
+ * Every request is the working directory and command line of a client invocation,
+ * the reply is its exit code and output. Requests are compiled in parallel by a pool
+ * of threads that keep their targets initialized between requests.
+ * @param threads worker count, 0 for one per hardware thread
+ * @return process exit code when the socket can't be set up
+ */
+int runServer(const std::string & socket_path, unsigned threads);
+
+/**
+ * Runs the invocation on a server and prints its output
+ * @param exit_code set to the exit code of the remote compilation
+ * @return false when no server answered, the invocation should then be compiled locally
+ */
+bool forwardToServer(const std::string & socket_path, int argc, const char * const argv[], int & exit_code);
+
+#endif //PAS_COMPILER_SERVER_H
@@ -0,0 +1,155 @@
+#include "Tiered.h"
+
+#include "AbstractSyntaxTree.h"
+#include "JIT.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/Threading.h"
+
+using namespace llvm;
+
+// Calls and loop iterations after which a routine is compiled
+static const uint32_t hot_threshold = 1000;
+// Native routines recurse on the VM's thread, which gets the stack of the interpreter
+static const unsigned stack_size = 512 << 20;
+// Prefix of the entries called by the VM, no Pascal name contains a dot
+static const std::string entry_prefix = "tier.";
+
+TieredExecution::TieredExecution(ASTProgram & program, const Resolver & resolver, const BytecodeProgram & bytecode,
+                                 const CompileOptions & options)
+	: NativeTier(bytecode.functions.size()), program(program), resolver(resolver), options(options), vm(bytecode)
+{
+	vm.setNativeTier(this, hot_threshold);
+}
+
+TieredExecution::~TieredExecution() = default;
+
+int TieredExecution::run()
+{
+	compiler = std::thread(&TieredExecution::compileHotRoutines, this);
+	llvm_execute_on_thread([](void * execution) {
+		auto tiered = static_cast<TieredExecution *>(execution);
+		tiered -> exit_code = tiered -> vm.run();
+	}, this, stack_size);
+
+	// A routine being compiled is finished, the rest of the queue is dropped
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		finished = true;
+	}
+	wake.notify_one();
+	compiler.join();
+	return exit_code;
+}
+
+void TieredExecution::hot(unsigned function)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requests.push_back(function);
+	}
+	wake.notify_one();
+}
+
+void TieredExecution::compileHotRoutines()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for ( ;; ) {
+		wake.wait(lock, [this] { return finished || !requests.empty(); });
+		if ( finished )
+			break;
+		unsigned function = requests.front();
+		requests.pop_front();
+
+		lock.unlock();
+		if ( !failed && (jit || startJIT()) )
+			compileRoutine(function);
+		lock.lock();
+	}
+	lock.unlock();
+	jit.reset();
+}
+
+/**
+ * Adds an entry for every routine, which takes its arguments from the frame the VM set up:
+ *   i32 tier.routine(i32 * registers, i32 ** references)
+ * Value parameters are read from their registers and copied arrays are passed by the address
+ * of their registers, the callee copies them once more. var parameters and const arrays are
+ * the references.
+ */
+static void addEntries(Module & module, const Resolver & resolver)
+{
+	LLVMContext & context = module.getContext();
+	IRBuilder<> builder(context);
+	Type * int_type = Type::getInt32Ty(context);
+	Type * registers_type = int_type -> getPointerTo();
+	Type * references_type = registers_type -> getPointerTo();
+	FunctionType * entry_type = FunctionType::get(int_type, {registers_type, references_type}, false);
+
+	for ( const ResolvedRoutine & routine : resolver.routines ) {
+		Function * function = module.getFunction(routine.name);
+		if ( !routine.function || !function || function -> isDeclaration() )
+			continue;
+
+		Function * entry = Function::Create(entry_type, Function::ExternalLinkage, entry_prefix + routine.name, &module);
+		builder.SetInsertPoint(BasicBlock::Create(context, "entry", entry));
+		Value * registers = &*entry -> arg_begin();
+		Value * references = &*std::next(entry -> arg_begin());
+
+		std::vector<Value *> arguments;
+		for ( unsigned i = 0; i < routine.parameters.size(); i++ ) {
+			const VariableSlot & slot = routine.parameters[i].slot;
+			Type * type = function -> getFunctionType() -> getParamType(i);
+			Value * index = ConstantInt::get(int_type, slot.index);
+			if ( slot.kind == VariableSlot::reference )
+				arguments.push_back(builder.CreateBitCast(builder.CreateLoad(builder.CreateGEP(references, index)), type));
+			else if ( slot.array )
+				arguments.push_back(builder.CreateBitCast(builder.CreateGEP(registers, index), type));
+			else
+				arguments.push_back(builder.CreateLoad(builder.CreateGEP(registers, index)));
+		}
+
+		CallInst * call = builder.CreateCall(function, arguments);
+		call -> setCallingConv(function -> getCallingConv());
+		builder.CreateRet(function -> getReturnType() -> isVoidTy() ? ConstantInt::get(int_type, 0) : (Value *) call);
+	}
+}
+
+bool TieredExecution::startJIT()
+{
+	TraceScope scope("tiered", "start JIT");
+	try {
+		std::unique_ptr<Module> module = program.generateModule(options);
+		if ( !module )
+			throw "Code generation failed";
+		addEntries(*module, resolver);
+		// The code only runs once it is hot, which makes optimizing it worth it
+		jit = std::make_unique<PascalJIT>(std::move(module), std::max(options.opt_level, 2u), true);
+	} catch (const char *) {
+		failed = true;
+	} catch (const std::string &) {
+		failed = true;
+	}
+	if ( failed )
+		return false;
+
+	// The native code works on the VM's variables
+	int32_t * globals = vm.globalData();
+	for ( auto & global : resolver.globalSlots() )
+		jit -> mapGlobal(global.first, globals + global.second.index);
+	return true;
+}
+
+void TieredExecution::compileRoutine(unsigned function)
+{
+	const std::string & name = resolver.routines[function].name;
+	TraceScope scope("tiered", name);
+	// Together with the routine and everything it calls, the VM's thread never waits for LLVM
+	auto entry = (Entry) jit -> compileRoutine(entry_prefix + name);
+	if ( !entry )
+		return;
+	entries[function].store(entry, std::memory_order_release);
+}
@@ -0,0 +1,60 @@
+#ifndef PAS_COMPILER_TIERED_H
+#define PAS_COMPILER_TIERED_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "Options.h"
+#include "Resolver.h"
+#include "VirtualMachine.h"
+
+class ASTProgram;
+class PascalJIT;
+
+/**
+ * Runs a program for --tiered. The bytecode VM starts it right away and counts the calls and
+ * loop iterations of every routine; a routine crossing the threshold is compiled by the lazy
+ * JIT on a background thread and its later calls run the native code. LLVM is only set up
+ * when the first routine gets hot, so short programs never pay for it.
+ * Running activations stay in the VM, the main program is never compiled.
+ */
+class TieredExecution : public NativeTier
+{
+public:
+	// program, resolver and bytecode have to outlive the execution
+	TieredExecution(ASTProgram & program, const Resolver & resolver, const BytecodeProgram & bytecode,
+	                const CompileOptions & options);
+	~TieredExecution() override;
+
+	// Runs the main program, @return the exit code
+	int run();
+	void hot(unsigned function) override;
+
+private:
+	// Body of the compiler thread
+	void compileHotRoutines();
+	// Generates the program's module with the entries of the VM and starts the JIT, @return false on failure
+	bool startJIT();
+	void compileRoutine(unsigned function);
+
+	ASTProgram & program;
+	const Resolver & resolver;
+	const CompileOptions options;
+	VirtualMachine vm;
+	int exit_code = 0;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<unsigned> requests;
+	bool finished = false;
+	std::thread compiler;
+
+	// Used by the compiler thread only, which also destroys it: its modules belong to the thread's context
+	std::unique_ptr<PascalJIT> jit;
+	bool failed = false;
+};
+
+#endif //PAS_COMPILER_TIERED_H
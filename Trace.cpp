@@ -0,0 +1,157 @@
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Report.h"
+
+using namespace llvm;
+
+bool trace_enabled = false;
+
+struct TraceEvent
+{
+	const char * category;
+	std::string name;
+	char phase;          // 'B' or 'E'
+	uint64_t timestamp;  // microseconds
+	unsigned thread;
+};
+
+static std::mutex events_mutex;
+static std::vector<TraceEvent> events;
+static std::chrono::steady_clock::time_point trace_start;
+
+// Small sequential thread ids read better in the viewer than native ones
+static unsigned traceThreadId()
+{
+	static std::atomic<unsigned> next_id(1);
+	static thread_local unsigned id = next_id++;
+	return id;
+}
+
+static void addEvent(const char * category, const std::string & name, char phase)
+{
+	auto elapsed = std::chrono::steady_clock::now() - trace_start;
+	uint64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+	unsigned thread = traceThreadId();
+
+	std::lock_guard<std::mutex> lock(events_mutex);
+	events.push_back({category, name, phase, timestamp, thread});
+}
+
+void enableTracing()
+{
+	trace_start = std::chrono::steady_clock::now();
+	trace_enabled = true;
+}
+
+void traceBegin(const char * category, const std::string & name)
+{
+	addEvent(category, name, 'B');
+}
+
+void traceEnd(const char * category, const std::string & name)
+{
+	addEvent(category, name, 'E');
+}
+
+bool writeTrace(const std::string & file, std::string & error)
+{
+	std::error_code EC;
+	raw_fd_ostream out(file, EC, sys::fs::F_Text);
+	if ( EC ) {
+		error = EC.message();
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(events_mutex);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	for ( size_t i = 0; i < events.size(); i++ ) {
+		auto & event = events[i];
+		out << "{\"name\":";
+		writeJSONString(out, event.name);
+		out << ",\"cat\":\"" << event.category << "\",\"ph\":\"" << event.phase << "\",\"ts\":" << event.timestamp
+		    << ",\"pid\":" << getpid() << ",\"tid\":" << event.thread << "}" << (i + 1 < events.size() ? ",\n" : "\n");
+	}
+	out << "]}\n";
+	return true;
+}
+
+static void markPass(const std::string & pass_name, bool begin)
+{
+	if ( begin )
+		traceBegin("pass", pass_name);
+	else
+		traceEnd("pass", pass_name);
+}
+
+/// Emits the begin or end event of the surrounded function pass, for every function
+class FunctionTraceMarker : public FunctionPass
+{
+public:
+	static char ID;
+
+	FunctionTraceMarker(StringRef pass_name, bool begin) : FunctionPass(ID), pass_name(pass_name), begin(begin) {}
+
+	StringRef getPassName() const override { return "Trace marker"; }
+	void getAnalysisUsage(AnalysisUsage & usage) const override { usage.setPreservesAll(); }
+
+	bool runOnFunction(Function &) override
+	{
+		markPass(pass_name, begin);
+		return false;
+	}
+
+private:
+	std::string pass_name;
+	bool begin;
+};
+
+/// Emits the begin or end event of the surrounded module pass
+class ModuleTraceMarker : public ModulePass
+{
+public:
+	static char ID;
+
+	ModuleTraceMarker(StringRef pass_name, bool begin) : ModulePass(ID), pass_name(pass_name), begin(begin) {}
+
+	StringRef getPassName() const override { return "Trace marker"; }
+	void getAnalysisUsage(AnalysisUsage & usage) const override { usage.setPreservesAll(); }
+
+	bool runOnModule(Module &) override
+	{
+		markPass(pass_name, begin);
+		return false;
+	}
+
+private:
+	std::string pass_name;
+	bool begin;
+};
+
+char FunctionTraceMarker::ID = 0;
+char ModuleTraceMarker::ID = 0;
+
+Pass * createTraceMarker(Pass * pass, bool begin)
+{
+	// Immutable passes only provide information and never run, but they report PT_Module
+	if ( pass -> getAsImmutablePass() )
+		return nullptr;
+	switch ( pass -> getPassKind() ) {
+		case PT_Function:
+			return new FunctionTraceMarker(pass -> getPassName(), begin);
+		case PT_Module:
+			return new ModuleTraceMarker(pass -> getPassName(), begin);
+		default:
+			return nullptr;
+	}
+}
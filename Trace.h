@@ -0,0 +1,83 @@
+#ifndef PAS_COMPILER_TRACE_H
+#define PAS_COMPILER_TRACE_H
+
+#include <cstdint>
+#include <string>
+
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Pass.h"
+
+/**
+ * Chrome trace events (chrome://tracing, Perfetto) for --trace.
+ * Events are buffered in memory and written by writeTrace at the end of the run.
+ * While tracing is disabled every entry point returns after testing one flag.
+ */
+extern bool trace_enabled;
+
+// Call before any compilation thread starts
+void enableTracing();
+inline bool tracingEnabled() { return trace_enabled; }
+
+// Paired begin and end events, they must nest on each thread
+void traceBegin(const char * category, const std::string & name);
+void traceEnd(const char * category, const std::string & name);
+
+/**
+ * Writes the events collected so far as a JSON trace file
+ * @return false with error set when the file can't be written
+ */
+bool writeTrace(const std::string & file, std::string & error);
+
+// Traces the enclosing scope
+class TraceScope
+{
+public:
+	TraceScope(const char * category, const std::string & name) : category(category)
+	{
+		if ( tracingEnabled() ) {
+			this -> name = name;
+			traceBegin(category, name);
+		}
+	}
+	~TraceScope()
+	{
+		if ( tracingEnabled() )
+			traceEnd(category, name);
+	}
+
+private:
+	const char * category;
+	std::string name;
+};
+
+// Pass marking the start or the end of the pass it surrounds, null for passes that can't be surrounded
+llvm::Pass * createTraceMarker(llvm::Pass * pass, bool begin);
+
+/**
+ * Pass manager tracing every function and module pass while tracing is enabled.
+ * Markers only go where the pipeline already has a boundary: function markers join the
+ * function pass manager of their pass and module markers surround module passes, which
+ * end it anyway. Loop and call graph passes are not surrounded, a marker between them
+ * would split their pipeline, and neither are immutable passes.
+ */
+template<typename Manager>
+class TracingPassManager : public Manager
+{
+public:
+	using Manager::Manager;
+
+	void add(llvm::Pass * pass) override
+	{
+		llvm::Pass * begin = tracingEnabled() ? createTraceMarker(pass, true) : nullptr;
+		if ( !begin ) {
+			Manager::add(pass);
+			return;
+		}
+		llvm::Pass * end = createTraceMarker(pass, false);
+		Manager::add(begin);
+		Manager::add(pass);
+		Manager::add(end);
+	}
+};
+
+#endif //PAS_COMPILER_TRACE_H
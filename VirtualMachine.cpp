@@ -0,0 +1,289 @@
+#include "VirtualMachine.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Computed gotos give every handler its own indirect jump to the next one, which branch
+// predictors learn much better than the single jump of a switch. Other compilers use a switch.
+#if defined(__GNUC__)
+#define PAS_COMPUTED_GOTO
+#endif
+
+// Only the pages of the stacks that are used get memory
+static const size_t stack_registers = 64 << 20;
+static const size_t stack_references = 4 << 20;
+// Calls nest as deep as in the interpreter, so a runaway recursion ends the same way
+static const size_t max_depth = 200000;
+
+// Words taken by every instruction
+enum : size_t
+{
+#define PAS_OPCODE_LENGTH(name, operands) length_##name = sizeof(operands),
+	PAS_OPCODES(PAS_OPCODE_LENGTH)
+#undef PAS_OPCODE_LENGTH
+};
+
+VirtualMachine::VirtualMachine(const BytecodeProgram & program)
+	: program(program), globals(program.globals, 0) {}
+
+void VirtualMachine::setNativeTier(NativeTier * native_tier, uint32_t hot_threshold)
+{
+	tier = native_tier;
+	threshold = hot_threshold;
+	counters.assign(program.functions.size(), 0);
+}
+
+// Zeroes the locals of a new frame and loads the constants of function
+static void enterFunction(const BytecodeFunction & function, int32_t * registers)
+{
+	std::fill(registers + function.parameters, registers + function.locals, 0);
+	std::copy(function.constants.begin(), function.constants.end(), registers + function.locals);
+}
+
+int VirtualMachine::run()
+{
+	return tier ? execute<true>() : execute<false>();
+}
+
+// Instantiated without the counting for plain --vm
+template <bool tiered>
+int VirtualMachine::execute()
+{
+	std::unique_ptr<int32_t[]> register_stack(new int32_t[stack_registers]);
+	std::unique_ptr<int32_t *[]> reference_stack(new int32_t *[stack_references]);
+	const int32_t * register_end = register_stack.get() + stack_registers;
+	int32_t * const * reference_end = reference_stack.get() + stack_references;
+	std::vector<CallFrame> frames;
+
+	const BytecodeFunction * function = &program.functions.back();
+	int32_t * registers = register_stack.get();
+	int32_t ** references = reference_stack.get();
+	if ( registers + function -> frame_size > register_end )
+		goto stack_overflow;
+	enterFunction(*function, registers);
+
+	{
+		const int32_t * code = function -> code.data();
+		const int32_t * pc = code;
+		// Set by lea instructions for the instructions taking an address
+		int32_t * pointers[2] = {nullptr, nullptr};
+		int32_t bad_index = 0;
+		uint32_t offset;
+		// Reports a function to the tier when it becomes hot
+		auto count = [&](size_t index) {
+			if ( ++counters[index] == threshold && index + 1 < program.functions.size() )
+				tier -> hot(index);
+		};
+
+#define R(operand) registers[pc[operand]]
+#define CHECKED(index, lower, size) \
+	offset = (uint32_t) (index) - (uint32_t) (lower); \
+	if ( offset >= (uint32_t) (size) ) { \
+		bad_index = (index); \
+		goto range_error; \
+	}
+
+#ifdef PAS_COMPUTED_GOTO
+		// Labels as values are an extension, which only the table and the jumps through it use
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+		static const void * const handlers[] = {
+#define PAS_OPCODE_HANDLER(name, operands) &&do_##name,
+			PAS_OPCODES(PAS_OPCODE_HANDLER)
+#undef PAS_OPCODE_HANDLER
+		};
+#pragma GCC diagnostic pop
+#define DISPATCH() \
+	_Pragma("GCC diagnostic push") \
+	_Pragma("GCC diagnostic ignored \"-Wpedantic\"") \
+	goto *handlers[*pc]; \
+	_Pragma("GCC diagnostic pop")
+#define HANDLER(name) do_##name:
+		DISPATCH();
+		{
+#else
+#define DISPATCH() continue
+#define HANDLER(name) case Opcode::name:
+		for ( ;; ) switch ( (Opcode) *pc ) {
+#endif
+#define NEXT(name) pc += length_##name; DISPATCH()
+#define JUMP(target) pc = code + (target); DISPATCH()
+// Jumps back are the loop iterations, the main program is never compiled and isn't counted
+#define BACK_EDGE(target) \
+	if ( tiered && (target) <= pc - code ) \
+		count(function - program.functions.data());
+#define ARITHMETIC(name, expression) \
+	HANDLER(name) R(1) = (int32_t) (expression); NEXT(name);
+#define COMPARISON(name, compare) \
+	HANDLER(name) R(1) = R(2) compare R(3) ? -1 : 0; NEXT(name);
+#define BRANCH(name, compare) \
+	HANDLER(name) if ( R(1) compare R(2) ) { BACK_EDGE(pc[3]); JUMP(pc[3]); } NEXT(name);
+
+			HANDLER(halt)
+				return 0;
+			HANDLER(ret) {
+				int32_t value = function -> result >= 0 ? registers[function -> result] : 0;
+				const CallFrame & caller = frames.back();
+				function = caller.function;
+				code = function -> code.data();
+				pc = caller.pc;
+				registers = caller.registers;
+				references = caller.references;
+				if ( caller.result >= 0 )
+					registers[caller.result] = value;
+				frames.pop_back();
+				DISPATCH();
+			}
+
+			HANDLER(mov) R(1) = R(2); NEXT(mov);
+			HANDLER(loadg) R(1) = globals[pc[2]]; NEXT(loadg);
+			HANDLER(storeg) globals[pc[1]] = R(2); NEXT(storeg);
+			HANDLER(loadr) R(1) = *references[pc[2]]; NEXT(loadr);
+			HANDLER(storer) *references[pc[1]] = R(2); NEXT(storer);
+
+			HANDLER(loadel)
+				CHECKED(R(3), pc[4], pc[5]);
+				R(1) = registers[pc[2] + offset];
+				NEXT(loadel);
+			HANDLER(loadelg)
+				CHECKED(R(3), pc[4], pc[5]);
+				R(1) = globals[pc[2] + offset];
+				NEXT(loadelg);
+			HANDLER(loadelr)
+				CHECKED(R(3), pc[4], pc[5]);
+				R(1) = references[pc[2]][offset];
+				NEXT(loadelr);
+			HANDLER(storeel)
+				CHECKED(R(2), pc[4], pc[5]);
+				registers[pc[1] + offset] = R(3);
+				NEXT(storeel);
+			HANDLER(storeelg)
+				CHECKED(R(2), pc[4], pc[5]);
+				globals[pc[1] + offset] = R(3);
+				NEXT(storeelg);
+			HANDLER(storeelr)
+				CHECKED(R(2), pc[4], pc[5]);
+				references[pc[1]][offset] = R(3);
+				NEXT(storeelr);
+
+			// Overflows wrap around like in the generated code
+			ARITHMETIC(add, (uint32_t) R(2) + (uint32_t) R(3))
+			ARITHMETIC(sub, (uint32_t) R(2) - (uint32_t) R(3))
+			ARITHMETIC(mul, (uint32_t) R(2) * (uint32_t) R(3))
+			ARITHMETIC(bit_and, R(2) & R(3))
+			ARITHMETIC(bit_or, R(2) | R(3))
+			ARITHMETIC(shl, (uint32_t) R(2) << (R(3) & 31))
+			ARITHMETIC(shr, (uint32_t) R(2) >> (R(3) & 31))
+			ARITHMETIC(addi, (uint32_t) R(2) + (uint32_t) pc[3])
+			HANDLER(div)
+				if ( R(3) == 0 )
+					goto division_by_zero;
+				R(1) = R(2) == INT_MIN && R(3) == -1 ? INT_MIN : R(2) / R(3);
+				NEXT(div);
+			HANDLER(mod)
+				if ( R(3) == 0 )
+					goto division_by_zero;
+				R(1) = R(2) == INT_MIN && R(3) == -1 ? 0 : R(2) % R(3);
+				NEXT(mod);
+
+			COMPARISON(eq, ==)
+			COMPARISON(ne, !=)
+			COMPARISON(lt, <)
+			COMPARISON(le, <=)
+			COMPARISON(gt, >)
+			COMPARISON(ge, >=)
+
+			HANDLER(jmp) BACK_EDGE(pc[1]); JUMP(pc[1]);
+			HANDLER(jz) if ( !R(1) ) { BACK_EDGE(pc[2]); JUMP(pc[2]); } NEXT(jz);
+			HANDLER(jnz) if ( R(1) ) { BACK_EDGE(pc[2]); JUMP(pc[2]); } NEXT(jnz);
+			BRANCH(jeq, ==)
+			BRANCH(jne, !=)
+			BRANCH(jlt, <)
+			BRANCH(jle, <=)
+			BRANCH(jgt, >)
+			BRANCH(jge, >=)
+			// Steps the control variable of a for loop unless it reached the last value
+			HANDLER(loop)
+				if ( R(1) != R(2) ) {
+					R(1) = (int32_t) ((uint32_t) R(1) + (uint32_t) pc[3]);
+					BACK_EDGE(pc[4]);
+					JUMP(pc[4]);
+				}
+				NEXT(loop);
+
+			HANDLER(call)
+			HANDLER(callv) {
+				bool call = (Opcode) *pc == Opcode::call;
+				const BytecodeFunction * callee = &program.functions[pc[1]];
+				int32_t * callee_registers = registers + pc[2];
+				int32_t ** callee_references = references + function -> references;
+				if ( tiered ) {
+					count(pc[1]);
+					if ( NativeTier::Entry entry = tier -> entry(pc[1]) ) {
+						int32_t value = entry(callee_registers, callee_references);
+						if ( call )
+							R(3) = value;
+						pc += call ? length_call : length_callv;
+						DISPATCH();
+					}
+				}
+				if ( frames.size() >= max_depth || callee_registers + callee -> frame_size > register_end
+				     || callee_references + callee -> references > reference_end )
+					goto stack_overflow;
+				frames.push_back({function, pc + (call ? length_call : length_callv), registers, references,
+				                  call ? pc[3] : -1});
+				enterFunction(*callee, callee_registers);
+				function = callee;
+				code = pc = function -> code.data();
+				registers = callee_registers;
+				references = callee_references;
+				DISPATCH();
+			}
+
+			HANDLER(lea) pointers[pc[1]] = registers + pc[2]; NEXT(lea);
+			HANDLER(leag) pointers[pc[1]] = globals.data() + pc[2]; NEXT(leag);
+			HANDLER(lear) pointers[pc[1]] = references[pc[2]]; NEXT(lear);
+			HANDLER(leael)
+				CHECKED(R(2), pc[3], pc[4]);
+				pointers[pc[1]] += offset;
+				NEXT(leael);
+			// The callee's references follow the caller's, checked here as they are written before the call
+			HANDLER(argref)
+				if ( references + function -> references + pc[1] >= reference_end )
+					goto stack_overflow;
+				references[function -> references + pc[1]] = pointers[pc[2]];
+				NEXT(argref);
+			HANDLER(argcopy) std::copy_n(pointers[pc[2]], pc[3], registers + pc[1]); NEXT(argcopy);
+			HANDLER(copy) memmove(pointers[pc[1]], pointers[pc[2]], pc[3] * sizeof(int32_t)); NEXT(copy);
+			HANDLER(read) scanf("%d", pointers[pc[1]]); NEXT(read);
+			HANDLER(dec) *pointers[pc[1]] = (int32_t) ((uint32_t) *pointers[pc[1]] - 1); NEXT(dec);
+
+			HANDLER(writei) printf("%d", R(1)); NEXT(writei);
+			HANDLER(writes) printf("%s", program.strings[pc[1]].c_str()); NEXT(writes);
+			HANDLER(writeln) printf("\n"); NEXT(writeln);
+#ifndef PAS_COMPUTED_GOTO
+			default:
+				return 0;
+#endif
+		}
+
+// Runtime errors go to stderr like those of the interpreter
+range_error:
+		fflush(stdout);
+		fprintf(stderr, "Range check error: index %d out of bounds\n", bad_index);
+		return 201;
+division_by_zero:
+		fflush(stdout);
+		fprintf(stderr, "Division by zero\n");
+		return 200;
+	}
+
+stack_overflow:
+	fflush(stdout);
+	fprintf(stderr, "Stack overflow\n");
+	return 202;
+}
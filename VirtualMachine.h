@@ -0,0 +1,78 @@
+#ifndef PAS_COMPILER_VIRTUALMACHINE_H
+#define PAS_COMPILER_VIRTUALMACHINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Bytecode.h"
+
+/**
+ * Native code of the functions of a program, which a JIT provides while the VM runs it.
+ * An entry runs a function with its frame as the VM set it up for the call.
+ */
+class NativeTier
+{
+public:
+	using Entry = int32_t (*)(int32_t * registers, int32_t ** references);
+
+	explicit NativeTier(size_t functions) : entries(new std::atomic<Entry>[functions]())
+	{
+		for ( size_t i = 0; i < functions; i++ )
+			entries[i].store(nullptr, std::memory_order_relaxed);
+	}
+	virtual ~NativeTier() = default;
+
+	// Called on the VM's thread once for each function reaching the threshold, must not block
+	virtual void hot(unsigned function) = 0;
+	Entry entry(unsigned function) const { return entries[function].load(std::memory_order_acquire); }
+
+protected:
+	std::unique_ptr<std::atomic<Entry>[]> entries;
+};
+
+/**
+ * Runs bytecode for --vm. Integers are kept unboxed in the registers of the frames, which
+ * are placed on one stack: a call puts the callee's frame right at the registers where the
+ * caller computed the arguments, so nothing is copied. Variables passed by reference are
+ * pointers on a second stack. The output and the runtime errors are those of --interpret.
+ * With a NativeTier, calls and loop iterations of every function are counted, hot functions
+ * are reported to the tier and their calls go to the native code as soon as it is there.
+ */
+class VirtualMachine
+{
+public:
+	// program has to outlive the VM
+	explicit VirtualMachine(const BytecodeProgram & program);
+
+	// Counts towards threshold with tier, which has to outlive run
+	void setNativeTier(NativeTier * tier, uint32_t threshold);
+	// The VM's globals, in the order of the Resolver
+	int32_t * globalData() { return globals.data(); }
+
+	// Runs the main program, @return the exit code
+	int run();
+
+private:
+	template <bool tiered>
+	int execute();
+
+	struct CallFrame
+	{
+		const BytecodeFunction * function;
+		const int32_t * pc;      // return address
+		int32_t * registers;
+		int32_t ** references;
+		int32_t result;          // register receiving the result, -1 for none
+	};
+
+	const BytecodeProgram & program;
+	std::vector<int32_t> globals;
+	NativeTier * tier = nullptr;
+	uint32_t threshold = 0;
+	// Calls and loop iterations of each function
+	std::vector<uint32_t> counters;
+};
+
+#endif //PAS_COMPILER_VIRTUALMACHINE_H
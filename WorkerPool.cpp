@@ -0,0 +1,62 @@
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(unsigned threads)
+{
+	if ( threads == 0 )
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for ( unsigned i = 0; i < threads; i++ )
+		workers.emplace_back([this] { work(); });
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	job_added.notify_all();
+	for ( auto & worker : workers )
+		worker.join();
+}
+
+void WorkerPool::async(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push(std::move(job));
+	}
+	job_added.notify_one();
+}
+
+void WorkerPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	job_done.wait(lock, [this] { return jobs.empty() && active == 0; });
+}
+
+void WorkerPool::work()
+{
+	while ( true ) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			job_added.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if ( jobs.empty() )
+				return;
+			job = std::move(jobs.front());
+			jobs.pop();
+			active++;
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			active--;
+		}
+		job_done.notify_all();
+	}
+}
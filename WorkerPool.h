@@ -0,0 +1,40 @@
+#ifndef PAS_COMPILER_WORKERPOOL_H
+#define PAS_COMPILER_WORKERPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of threads running queued jobs.
+ * The threads live as long as the pool, so per-thread state (code generation context,
+ * target machines) is built once and reused by every job the thread runs.
+ */
+class WorkerPool
+{
+public:
+	// 0 threads means one per hardware thread
+	explicit WorkerPool(unsigned threads);
+	// Finishes all queued jobs
+	~WorkerPool();
+
+	void async(std::function<void()> job);
+	// Blocks until the queue is empty and no job is running
+	void wait();
+
+private:
+	void work();
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable job_added;
+	std::condition_variable job_done;
+	unsigned active = 0;
+	bool stopping = false;
+};
+
+#endif //PAS_COMPILER_WORKERPOOL_H
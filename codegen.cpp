@@ -4,44 +4,125 @@
 
 
 #include "llvm/ADT/Optional.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Support/TargetRegistry.h"
-#include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
-#include "llvm/Target/TargetOptions.h"
 
+#include <algorithm>
 #include <iostream>
+#include <set>
 
 #include "AbstractSyntaxTree.h"
+#include "Backend.h"
+#include "Effects.h"
+#include "Evaluator.h"
+#include "Optimizer.h"
+#include "Trace.h"
+#include "Linker.h"
 
 
-static LLVMContext TheContext;
-static IRBuilder<> Builder(TheContext);
-static std::unique_ptr<Module> TheModule;
+// Code generation state, one instance per thread so that compilations can run in parallel
+static thread_local LLVMContext TheContext;
+static thread_local IRBuilder<> Builder(TheContext);
+static thread_local std::unique_ptr<Module> TheModule;
 
-typedef std::pair<Value *, std::shared_ptr<ASTVariableType>> TVarInfo;
-
-static std::map<std::string, std::pair<AllocaInst *, std::shared_ptr<ASTVariableType>>> named_values;
-static std::map<std::string, std::pair<GlobalVariable *, std::shared_ptr<ASTVariableType>>> global_vars;
-static std::map<std::string, Constant *> const_vars;
+// Symbol table entry, resolved when the variable is declared
+struct TVarInfo
+{
+	Value * address = nullptr;
+	std::shared_ptr<ASTVariableType> type;
+	// Arrays: where the element with index 0 would be, indexing is a single GEP from it
+	Value * zero_element = nullptr;
+	int lower_bound = 0;
+	int upper_bound = -1;
+};
+
+static thread_local std::map<std::string, TVarInfo> named_values;
+static thread_local std::map<std::string, TVarInfo> global_vars;
+static thread_local std::map<std::string, Constant *> const_vars;
+// Parameter modes of the declared routines, calls pass var and const arguments by address
+static thread_local std::map<std::string, std::vector<ASTParameter::Mode>> routine_parameters;
+// const parameters of the routine being generated, they can't be assigned
+static thread_local std::set<std::string> const_parameters;
+// Side effects of the routines, known for each routine before it is generated
+static thread_local EffectAnalysis routine_effects;
+// Constants and the pure routines that can be run at compile time
+static thread_local ConstantEvaluator constant_evaluator;
+// Values of the loop invariant calls computed before their loop
+static thread_local std::map<const ASTFunctionCall *, Value *> hoisted_calls;
+
+// Routine being generated, its self calls in tail position jump back to its start
+struct TailRecursion
+{
+	const ASTFunctionPrototype * routine = nullptr;
+	BasicBlock * start_BB = nullptr;
+	// Value parameters, null for the ones passed by reference and arrays
+	std::vector<AllocaInst *> parameters;
+};
+static thread_local TailRecursion tail_recursion;
+
+static thread_local Value * decimal_specifier_character;
+static thread_local Value * string_specifier_character;
+static thread_local Value * new_line_specifier;
+
+// Options of the compilation in progress
+static thread_local const CompileOptions * TheOptions;
+// Receives the codegen stage times, null unless --time-report
+static thread_local CompileReport * TheReport;
+
+// Jump targets of the enclosing loops, innermost last
+struct LoopTargets
+{
+	BasicBlock * continue_BB;
+	BasicBlock * break_BB;
+};
+static thread_local std::vector<LoopTargets> loop_stack;
+// Return block of the routine or program being generated, the target of exit
+static thread_local BasicBlock * exit_BB;
+
+// Control variables of the enclosing for loops, with their range when it is known at compile time
+struct ControlVariable
+{
+	bool bounded;
+	int min, max;
+};
+static thread_local std::map<std::string, ControlVariable> control_variables;
 
-static Value * decimal_specifier_character;
-static Value * string_specifier_character;
-static Value * new_line_specifier;
+// Keeps the control variable of a for loop from being assigned in the loop body
+class ControlVariableScope
+{
+public:
+	ControlVariableScope(const std::string & name, ControlVariable range) : name(name) { control_variables[name] = range; }
+	~ControlVariableScope() { control_variables.erase(name); }
+private:
+	std::string name;
+};
+
+// Makes break and continue in a loop body jump to the loop's blocks, also when the body fails
+class LoopScope
+{
+public:
+	LoopScope(BasicBlock * continue_BB, BasicBlock * break_BB) { loop_stack.push_back({continue_BB, break_BB}); }
+	~LoopScope() { loop_stack.pop_back(); }
+};
 
 //std::unique_ptr<legacy::FunctionPassManager> TheFPM;
 
@@ -52,8 +133,158 @@ static AllocaInst * CreateEntryBlockAlloca(Function *TheFunction, const std::str
 {
 	IRBuilder<> TmpB(&TheFunction -> getEntryBlock(), TheFunction -> getEntryBlock().begin());
 
-	auto init_value = ConstantInt::get(Type::getInt32Ty(TheContext), (type->isArrayTy() ? type->getArrayNumElements() : 0), false);
-	return TmpB.CreateAlloca(type, init_value, VarName.c_str());
+	// A single object, arrays included
+	return TmpB.CreateAlloca(type, nullptr, VarName.c_str());
+}
+
+/**
+ * Symbol table entry of a variable stored at address. The lower bound of an array is
+ * applied to its address here, once, so accessing an element needs no subtraction.
+ */
+static TVarInfo resolveVariable(Value * address, const std::shared_ptr<ASTVariableType> & type)
+{
+	TVarInfo info;
+	info.address = address;
+	info.type = type;
+
+	auto array = std::dynamic_pointer_cast<ASTArray>(type);
+	if ( array ) {
+		Type * array_type = address -> getType() -> getPointerElementType();
+		Value * indices[] = {ConstantInt::get(Type::getInt32Ty(TheContext), 0),
+		                     ConstantInt::get(Type::getInt32Ty(TheContext), -array -> lower, true)};
+		// Out of bounds for lower bounds above 0, so not inbounds
+		if ( auto global = dyn_cast<Constant>(address) )
+			info.zero_element = ConstantExpr::getGetElementPtr(array_type, global, indices);
+		else
+			info.zero_element = Builder.CreateGEP(address, indices, address -> getName() + ".zero");
+		info.lower_bound = array -> lower;
+		info.upper_bound = array -> upper;
+	}
+	return info;
+}
+
+// Declares a C library function on first use
+static Function * getLibraryFunction(const std::string & name, FunctionType * type)
+{
+	Function * function = TheModule -> getFunction(name);
+	if ( !function ) {
+		function = Function::Create(type, Function::ExternalLinkage, name, TheModule.get());
+		function -> setCallingConv(CallingConv::C);
+	}
+	return function;
+}
+
+/**
+ * Ends the program with a runtime error: the output written so far is flushed, the message
+ * formatted with arguments goes to stderr and the program exits with exit_code
+ */
+static void codegenRuntimeError(IRBuilder<> & builder, const std::string & format, ArrayRef<Value *> arguments,
+                                int exit_code)
+{
+	Type * int_type = Type::getInt32Ty(TheContext);
+	PointerType * ptr = Type::getInt8PtrTy(TheContext);
+	Function * llvm_fflush = getLibraryFunction("fflush", FunctionType::get(int_type, {ptr}, false));
+	builder.CreateCall(llvm_fflush, {ConstantPointerNull::get(ptr)});
+
+	std::vector<Value *> print_arguments = {ConstantInt::get(int_type, 2), builder.CreateGlobalStringPtr(format)};
+	print_arguments.insert(print_arguments.end(), arguments.begin(), arguments.end());
+	builder.CreateCall(getLibraryFunction("dprintf", FunctionType::get(int_type, {int_type, ptr}, true)), print_arguments);
+
+	Function * llvm_exit = getLibraryFunction("exit", FunctionType::get(Type::getVoidTy(TheContext), {int_type}, false));
+	builder.CreateCall(llvm_exit, {ConstantInt::get(int_type, exit_code)});
+	builder.CreateUnreachable();
+}
+
+// Arrays are always passed by address, the callee copies value arrays itself.
+// const integers are cheaper to pass by value.
+static bool passedByReference(ASTParameter::Mode mode, Type * type)
+{
+	return mode == ASTParameter::var || type -> isArrayTy();
+}
+
+static void checkAssignable(const std::string & name)
+{
+	if ( const_parameters.count(name) )
+		throw "Assignment to const parameter " + name;
+	if ( control_variables.count(name) )
+		throw "Assignment to for loop control variable " + name;
+}
+
+/**
+ * Address passed for a by reference argument. A const argument which isn't a variable is
+ * passed in a temporary.
+ * @throw std::string when a var argument isn't a variable or has another type
+ */
+static Value * codegenArgumentAddress(ASTExpression & argument, ASTParameter::Mode mode, Type * type, const std::string & routine)
+{
+	auto reference = dynamic_cast<ASTReference *>(&argument);
+	Value * address = reference ? reference -> getAlloca() : nullptr;
+
+	if ( address ) {
+		if ( mode == ASTParameter::var )
+			checkAssignable(reference -> name);
+		if ( address -> getType() != type )
+			throw "Incompatible argument passed to " + routine;
+		return address;
+	}
+	if ( mode == ASTParameter::var )
+		throw "Variable expected as var argument of " + routine;
+
+	Value * value = argument.codegen();
+	if ( !value )
+		return nullptr;
+	if ( value -> getType() -> getPointerTo() != type )
+		throw "Incompatible argument passed to " + routine;
+	AllocaInst * temporary = CreateEntryBlockAlloca(Builder.GetInsertBlock() -> getParent(), "argument", value -> getType());
+	Builder.CreateStore(value, temporary);
+	return temporary;
+}
+
+// Allocates an array over --stack-array-limit, when malloc fails the program ends with exit code 203 like Turbo Pascal
+static Function * getAllocateFunction()
+{
+	Function * function = TheModule -> getFunction("pas_allocate");
+	if ( function )
+		return function;
+
+	PointerType * ptr = Type::getInt8PtrTy(TheContext);
+	FunctionType * function_type = FunctionType::get(ptr, {TheModule -> getDataLayout().getIntPtrType(TheContext)}, false);
+	function = Function::Create(function_type, Function::InternalLinkage, "pas_allocate", TheModule.get());
+	function -> addFnAttr(Attribute::NoRecurse);
+
+	IRBuilder<> builder(BasicBlock::Create(TheContext, "entry", function));
+	Value * memory = builder.CreateCall(getLibraryFunction("malloc", function_type), {&*function -> arg_begin()}, "memory");
+	BasicBlock * error_BB = BasicBlock::Create(TheContext, "heap_overflow", function);
+	BasicBlock * allocated_BB = BasicBlock::Create(TheContext, "allocated", function);
+	builder.CreateCondBr(builder.CreateIsNull(memory), error_BB, allocated_BB, MDBuilder(TheContext).createBranchWeights(1, 1 << 20));
+
+	builder.SetInsertPoint(error_BB);
+	codegenRuntimeError(builder, "Heap overflow\n", {}, 203);
+
+	builder.SetInsertPoint(allocated_BB);
+	builder.CreateRet(memory);
+	return function;
+}
+
+/**
+ * Allocates a local variable, on the stack unless it is an array over --stack-array-limit
+ * @param heap_arrays receives the heap allocations, to be freed when the routine returns
+ * @return pointer to the variable
+ */
+static Value * createLocalVariable(Function * function, const std::string & name, Type * type,
+                                   std::vector<Value *> & heap_arrays)
+{
+	const DataLayout & layout = TheModule -> getDataLayout();
+	uint64_t size = layout.getTypeAllocSize(type);
+	if ( !type -> isArrayTy() || size <= TheOptions -> stack_array_limit )
+		return CreateEntryBlockAlloca(function, name, type);
+
+	// Allocated after the allocas, entry block allocas stay together for mem2reg
+	IRBuilder<> TmpB(&function -> getEntryBlock());
+	Type * size_type = layout.getIntPtrType(TheContext);
+	Value * memory = TmpB.CreateCall(getAllocateFunction(), {ConstantInt::get(size_type, size)}, name + "_heap");
+	heap_arrays.push_back(memory);
+	return TmpB.CreateBitCast(memory, type -> getPointerTo(), name);
 }
 
 
@@ -77,8 +308,8 @@ Type * ASTInteger::codegen()
 Type * ASTArray::codegen ()
 {
 	Type * elem_type = type -> codegen();
-	int size = (upperIdx -> value) - (lowerIdx -> value) + 1;
-	return ArrayType::get(elem_type, size);
+	constant_evaluator.resolveBounds(*this);
+	return ArrayType::get(elem_type, (uint64_t) ((int64_t) upper - lower + 1));
 }
 
 Value * ASTBody::codegen ()
@@ -106,18 +337,95 @@ Value * ASTVariable::codegen ()
 		global_var -> setInitializer(ConstantAggregateZero::get(type_value));
 
 
-	global_vars[name] = std::make_pair(global_var, type);
+	global_vars[name] = resolveVariable(global_var, type);
+	routine_effects.addGlobal(name);
 
-	return global_vars[name].first;
+	return global_var;
 }
 // Const declaration
 Value * ASTConstVariable::codegen ()
 {
-	const_vars[name] = ConstantInt::get(TheContext, APInt(32, value, true));
+	int result = constant_evaluator.require(*value, "Constant " + name);
+	const_vars[name] = ConstantInt::get(TheContext, APInt(32, result, true));
+	constant_evaluator.addConstant(name, result);
 
 	return const_vars[name];
 }
 
+// Whether pointer addresses memory of the routine's own stack frame
+static bool isLocalMemory(Value * pointer)
+{
+	while ( true ) {
+		pointer = pointer -> stripPointerCasts();
+		auto gep = dyn_cast<GEPOperator>(pointer);
+		if ( !gep )
+			return isa<AllocaInst>(pointer);
+		pointer = gep -> getPointerOperand();
+	}
+}
+
+// Parameters passed by reference and arrays can only be handed on unchanged when the frame is reused
+bool ASTFunctionCall::canReuseFrame() const
+{
+	for ( unsigned i = 0; i < arguments.size(); i++ ) {
+		if ( tail_recursion.parameters[i] )
+			continue;
+		auto variable = dynamic_cast<ASTSingleVarReference *>(arguments[i].get());
+		if ( !variable || variable -> name != tail_recursion.routine -> parameters[i] -> name )
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Generates a self call in tail position as new values of the parameters and a jump
+ * to the start of the routine, so the recursion runs in the caller's frame
+ * @return the call's value, which is never used
+ */
+Value * ASTFunctionCall::codegenTailRecursion()
+{
+	std::vector<Value *> values;
+	for ( unsigned i = 0; i < arguments.size(); i++ ) {
+		if ( !tail_recursion.parameters[i] )
+			continue;
+		values.push_back(arguments[i] -> codegen());
+		if ( !values.back() )
+			return nullptr;
+	}
+
+	// All arguments are evaluated with the old values
+	auto value = values.begin();
+	for ( AllocaInst * parameter : tail_recursion.parameters )
+		if ( parameter )
+			Builder.CreateStore(*value++, parameter);
+	Builder.CreateBr(tail_recursion.start_BB);
+
+	auto after_BB = BasicBlock::Create(TheContext, "after_tail_call", Builder.GetInsertBlock() -> getParent());
+	Builder.SetInsertPoint(after_BB);
+
+	Type * result_type = Builder.GetInsertBlock() -> getParent() -> getReturnType();
+	if ( result_type -> isVoidTy() )
+		return Constant::getNullValue(Type::getInt32Ty(TheContext));
+	return UndefValue::get(result_type);
+}
+
+// Result of a call of a pure function the compiler can run, null when it has to be called
+static Constant * evaluateCall(ASTFunctionCall & call, const std::string & name, Function * function)
+{
+	const RoutineEffects * effects = routine_effects.find(name);
+	if ( !effects || effects -> purity != Purity::pure || function -> getReturnType() -> isVoidTy() )
+		return nullptr;
+
+	try {
+		int result = constant_evaluator.evaluate(call);
+		if ( TheReport )
+			TheReport -> evaluated_calls++;
+		return ConstantInt::get(TheContext, APInt(32, result, true));
+	} catch ( NotConstant & ) {
+		return nullptr;
+	}
+}
+
 Value * ASTFunctionCall::codegen ()
 {
 	if ( name == "writeln" || name == "write" ) {
@@ -142,6 +450,7 @@ Value * ASTFunctionCall::codegen ()
 			return nullptr;
 
 		ASTSingleVarReference * var = (ASTSingleVarReference *)arguments[0].get();
+		checkAssignable(var -> name);
 		Value * alloca = var -> getAlloca();
 		if ( !alloca )
 			return nullptr;
@@ -152,6 +461,7 @@ Value * ASTFunctionCall::codegen ()
 			return nullptr;
 
 		ASTSingleVarReference * var = (ASTSingleVarReference *)arguments[0].get();
+		checkAssignable(var -> name);
 		Value * alloca = var -> getAlloca();
 		if ( !alloca )
 			return nullptr;
@@ -160,31 +470,53 @@ Value * ASTFunctionCall::codegen ()
 
 		return Builder.CreateStore(new_value, alloca);
 	} else {
+			auto hoisted = hoisted_calls.find(this);
+			if ( hoisted != hoisted_calls.end() )
+				return hoisted -> second;
+
 			Function *f = TheModule->getFunction(name);
-			if ( !f ) {
-				printf("Error: Unknown function referenced\n");
-				return nullptr;
-			}
+			if ( !f )
+				throw "Unknown function referenced: " + name;
 
-			if ( f->arg_size() != arguments.size()) {
-				printf("Error: Incorrect number of arguments passed\n");
-				return NULL;
-			}
+			if ( f->arg_size() != arguments.size())
+				throw "Incorrect number of arguments passed to " + name;
+
+			if ( Constant * result = evaluateCall(*this, name, f) )
+				return result;
+
+			if ( tail_call && tail_recursion.start_BB && canReuseFrame() )
+				return codegenTailRecursion();
 
 			// Generate argument expr
+			const std::vector<ASTParameter::Mode> & modes = routine_parameters[name];
 			std::vector<Value *> arg_values;
-			for ( auto &arg : arguments )
-				arg_values.push_back(arg -> codegen());
+			for ( unsigned i = 0; i < arguments.size(); i++ ) {
+				Type * param_type = f -> getFunctionType() -> getParamType(i);
+				if ( param_type -> isPointerTy() )
+					arg_values.push_back(codegenArgumentAddress(*arguments[i], modes[i], param_type, name));
+				else
+					arg_values.push_back(arguments[i] -> codegen());
+			}
 
-			return Builder.CreateCall(f, arg_values);
+			CallInst * call = Builder.CreateCall(f, arg_values);
+			call -> setCallingConv(f -> getCallingConv());
+			// The callee can't see the caller's frame unless it gets one of its variables by reference
+			call -> setTailCall(std::none_of(arg_values.begin(), arg_values.end(), [](Value * value) {
+				return value -> getType() -> isPointerTy() && isLocalMemory(value);
+			}));
+			return call;
 	}
 }
 
 Function * ASTFunctionPrototype::codegen ()
 {
 	std::vector<Type *> param_types;
-	for ( auto & param : parameters )
-		param_types.push_back(param -> type -> codegen());
+	std::vector<ASTParameter::Mode> modes;
+	for ( auto & param : parameters ) {
+		Type * type = param -> type -> codegen();
+		param_types.push_back(passedByReference(param -> mode, type) ? type -> getPointerTo() : type);
+		modes.push_back(param -> mode);
+	}
 
 	FunctionType * function_type;
 	if ( returnType ) // Function
@@ -192,18 +524,122 @@ Function * ASTFunctionPrototype::codegen ()
 	else  // Procedure
 		function_type = FunctionType::get(Type::getVoidTy(TheContext), param_types, false);
 
+	// Declarations stay external until the body is generated, fastcc needs no ABI conformance
 	Function * function = Function::Create(function_type, Function::ExternalLinkage, name, TheModule.get());
+	function -> setCallingConv(CallingConv::Fast);
+	function -> addFnAttr(Attribute::NoUnwind);
 
 	// Set names for arguments to match prototype parameters
 	unsigned i = 0;
 	for ( auto & param : function -> args() )
 		param.setName(parameters[i++] -> name);
 
+	// Programs can't keep addresses, by reference arguments are only accessed during the call
+	const DataLayout & layout = TheModule -> getDataLayout();
+	for ( unsigned i = 0; i < parameters.size(); i++ ) {
+		if ( !param_types[i] -> isPointerTy() )
+			continue;
+		function -> addParamAttr(i, Attribute::NoCapture);
+		function -> addDereferenceableParamAttr(i, layout.getTypeAllocSize(param_types[i] -> getPointerElementType()));
+		if ( parameters[i] -> mode != ASTParameter::var )
+			function -> addParamAttr(i, Attribute::ReadOnly);
+		// As in Delphi, the argument of a const parameter must not be changed during the call
+		if ( parameters[i] -> mode == ASTParameter::constant )
+			function -> addParamAttr(i, Attribute::NoAlias);
+	}
+	routine_parameters[name] = modes;
+
 	return function;
 }
 
+/**
+ * Adds norecurse, readnone and readonly to a generated routine as far as its body shows.
+ * Callees are judged by their attributes, so calls of routines defined later count as
+ * recursive and writing memory.
+ */
+static void inferAttributes(Function & function)
+{
+	bool reads = false, writes = false, recurses = false;
+
+	for ( Instruction & instruction : instructions(function) ) {
+		if ( auto load = dyn_cast<LoadInst>(&instruction) ) {
+			reads |= !isLocalMemory(load -> getPointerOperand());
+		} else if ( auto store = dyn_cast<StoreInst>(&instruction) ) {
+			writes |= !isLocalMemory(store -> getPointerOperand());
+		} else if ( auto transfer = dyn_cast<MemTransferInst>(&instruction) ) {
+			reads |= !isLocalMemory(transfer -> getSource());
+			writes |= !isLocalMemory(transfer -> getDest());
+		} else if ( auto call = dyn_cast<CallInst>(&instruction) ) {
+			Function * callee = call -> getCalledFunction();
+			// C library functions can't call back into the program
+			bool library = callee && callee -> isDeclaration() && callee -> getCallingConv() == CallingConv::C;
+			if ( !callee || (!library && !callee -> doesNotRecurse()) )
+				recurses = true;
+			if ( callee && callee -> doesNotAccessMemory() )
+				continue;
+			reads = true;
+			writes |= !callee || !callee -> onlyReadsMemory();
+		}
+	}
+
+	if ( !recurses )
+		function.addFnAttr(Attribute::NoRecurse);
+	if ( !reads && !writes )
+		function.addFnAttr(Attribute::ReadNone);
+	else if ( !writes )
+		function.addFnAttr(Attribute::ReadOnly);
+}
+
+bool ASTBody::markTailCalls(const ASTFunctionPrototype & routine, bool tail)
+{
+	bool marked = false;
+	for ( size_t i = 0; i < content.size(); i++ ) {
+		// The last statement and the ones followed by exit end the routine
+		bool last = i + 1 == content.size() ? tail : dynamic_cast<ASTExit *>(content[i + 1].get()) != nullptr;
+		marked |= content[i] -> markTailCalls(routine, last);
+	}
+	return marked;
+}
+
+bool ASTIf::markTailCalls(const ASTFunctionPrototype & routine, bool tail)
+{
+	bool marked = then_body -> markTailCalls(routine, tail);
+	if ( else_body )
+		marked |= else_body -> markTailCalls(routine, tail);
+	return marked;
+}
+
+bool ASTFor::markTailCalls(const ASTFunctionPrototype & routine, bool)
+{
+	return body -> markTailCalls(routine, false);
+}
+
+bool ASTWhile::markTailCalls(const ASTFunctionPrototype & routine, bool)
+{
+	return body -> markTailCalls(routine, false);
+}
+
+// Procedures call themselves as a statement, functions assign the call to their result
+bool ASTAssignOp::markTailCalls(const ASTFunctionPrototype & routine, bool tail)
+{
+	auto call = dynamic_cast<ASTFunctionCall *>(value.get());
+	if ( !tail || !call || !call -> isCallOf(routine.getName()) || variable -> name != routine.getName()
+	     || !dynamic_cast<ASTSingleVarReference *>(variable.get()) )
+		return false;
+	call -> tail_call = true;
+	return true;
+}
+
+bool ASTFunctionCall::markTailCalls(const ASTFunctionPrototype & routine, bool tail)
+{
+	tail_call = tail && !routine.returnType && name == routine.getName();
+	return tail_call;
+}
+
 Function * ASTFunction::codegen ()
 {
+	TraceScope scope("codegen", prototype -> getName());
+
 	// Lookup function declaration
 	Function * function = TheModule -> getFunction(prototype -> getName());
 	if ( !function ) // Not yet generated
@@ -216,42 +652,74 @@ Function * ASTFunction::codegen ()
 	BasicBlock * return_BB = BasicBlock::Create(TheContext, "return_block: " + prototype -> getName(), function);
 
 	Builder.SetInsertPoint(function_BB);
+	exit_BB = return_BB;
 
 	// Remember the old variable binding so that we can restore the binding when
 	// we unrecurse.
-	std::map<std::string, std::pair<AllocaInst *, std::shared_ptr<ASTVariableType>>> old_named_values (named_values);
+	std::map<std::string, TVarInfo> old_named_values (named_values);
+	std::vector<Value *> heap_arrays;
 
 	// Save function arguments so they can be used as local variables
+	const_parameters.clear();
+	tail_recursion = TailRecursion();
+	tail_recursion.parameters.assign(prototype -> parameters.size(), nullptr);
 	int idx = 0;
 	for ( auto & arg : function -> args() ) {
-		// TODO maybe use name and type from prototype
+		auto & param = prototype -> parameters[idx++];
+
+		if ( param -> mode == ASTParameter::constant )
+			const_parameters.insert(param -> name);
+
+		// var parameters and const arrays use the caller's variable
+		if ( arg.getType() -> isPointerTy() && param -> mode != ASTParameter::value ) {
+			named_values[param -> name] = resolveVariable(&arg, param -> type);
+			continue;
+		}
+
+		// Value arrays are passed by address and copied once, here
+		if ( arg.getType() -> isPointerTy() ) {
+			Type * type = arg.getType() -> getPointerElementType();
+			Value * copy = createLocalVariable(function, param -> name, type, heap_arrays);
+			const DataLayout & layout = TheModule -> getDataLayout();
+			Builder.CreateMemCpy(copy, &arg, layout.getTypeAllocSize(type), layout.getABITypeAlignment(type));
+			named_values[param -> name] = resolveVariable(copy, param -> type);
+			continue;
+		}
+
 		// Create an alloca for arg
 		AllocaInst * alloca = CreateEntryBlockAlloca(function, arg.getName(), arg.getType());
 		// Store arg into the alloca.
 		Builder.CreateStore(&arg, alloca);
 		// Add arguments to variable symbol table.
-		named_values[arg.getName()] = std::make_pair(alloca, prototype -> parameters[idx++] -> type);
+		named_values[param -> name] = resolveVariable(alloca, param -> type);
+		tail_recursion.parameters[idx - 1] = alloca;
 	}
 
 	// Local variables
 	for ( auto & var : local_variables ) {
 		auto type_value = var -> type -> codegen();
-		AllocaInst * alloca = CreateEntryBlockAlloca(function, var -> name, type_value);
-		// Builder.CreateStore(ConstantInt::get(TheContext, APInt(32, 0, true)), alloca);  // TODO not for arrays
-		named_values[var -> name] = std::make_pair(alloca, var -> type);
+		Value * variable = createLocalVariable(function, var -> name, type_value, heap_arrays);
+		named_values[var -> name] = resolveVariable(variable, var -> type);
 	}
 
 	// Return variable for functions
 	if ( prototype -> returnType ) {
 		AllocaInst * alloca = CreateEntryBlockAlloca(function, prototype -> getName(), prototype -> returnType -> codegen());
 		// Builder.CreateStore(ConstantInt::get(TheContext, APInt(32, 0, true)), alloca);  // TODO not for arrays
-		named_values[prototype -> getName()] = std::make_pair(alloca, prototype -> returnType);;
+		named_values[prototype -> getName()] = resolveVariable(alloca, prototype -> returnType);
 	}
 
 
-	//Builder.SetInsertPoint(function_BB);
+	// Self calls in tail position continue here with the new parameter values
+	if ( body -> markTailCalls(*prototype, true) ) {
+		tail_recursion.routine = prototype.get();
+		tail_recursion.start_BB = BasicBlock::Create(TheContext, "tail_recursion", function, return_BB);
+		Builder.CreateBr(tail_recursion.start_BB);
+		Builder.SetInsertPoint(tail_recursion.start_BB);
+	}
 
 	auto body_value = body -> codegen();
+	tail_recursion = TailRecursion();
 	if ( !body_value )
 		return nullptr;
 
@@ -259,8 +727,15 @@ Function * ASTFunction::codegen ()
 	Builder.CreateBr(return_BB);
 	Builder.SetInsertPoint(return_BB);
 
+	if ( !heap_arrays.empty() ) {
+		PointerType * ptr = Type::getInt8PtrTy(TheContext);
+		Function * llvm_free = getLibraryFunction("free", FunctionType::get(Type::getVoidTy(TheContext), {ptr}, false));
+		for ( Value * memory : heap_arrays )
+			Builder.CreateCall(llvm_free, {memory});
+	}
+
 	if ( prototype -> returnType ) {
-		auto return_value = Builder.CreateLoad(named_values[prototype -> getName()].first);
+		auto return_value = Builder.CreateLoad(named_values[prototype -> getName()].address);
 		Builder.CreateRet(return_value);
 	} else {
 		Builder.CreateRetVoid();
@@ -271,6 +746,10 @@ Function * ASTFunction::codegen ()
 	assert(!verifyFunction(*function, &errs()));
 	//TheFPM -> run(*function);
 
+	// Routines are only called by the program itself
+	function -> setLinkage(GlobalValue::InternalLinkage);
+	inferAttributes(*function);
+
 	// Unrecurse
 	named_values = old_named_values;
 
@@ -281,12 +760,6 @@ Function * ASTFunction::codegen ()
 
 Value * ASTIf::codegen ()
 {
-	Value * condition_value = condition -> codegen();
-	if ( !condition_value )
-		return nullptr;
-
-	condition_value = Builder.CreateICmpNE(condition_value , ConstantInt::get(TheContext, APInt(32, 0, true)), "if_condition");
-
 	Function * parent = Builder.GetInsertBlock() -> getParent();
 
 	// Create blocks for the then and else cases.  Insert the 'then' block at the
@@ -295,7 +768,8 @@ Value * ASTIf::codegen ()
 	BasicBlock * else_BB = BasicBlock::Create(TheContext, "else", parent);
 	BasicBlock * after_BB = BasicBlock::Create(TheContext, "after_block", parent);
 
-	Builder.CreateCondBr(condition_value, then_BB, else_BB);
+	if ( !condition -> codegenBranch(then_BB, else_BB) )
+		return nullptr;
 
 
 	// Then body
@@ -339,59 +813,66 @@ Value * ASTFor::codegen()
 		info = global_vars[variable_name];
 	else
 		throw "Using an undeclared variable in for statement";
+	checkAssignable(variable_name);
 
-	// Create an alloca for the variable in the entry block.
-	//AllocaInst * Alloca = CreateEntryBlockAlloca(parent, variable_name, Type::getInt32Ty(TheContext));
-
-	// Codegen start value
+	// Both bounds are evaluated once, before the first iteration
 	Value * start_value = start -> codegen();
 	if ( !start_value )
 		return nullptr;
-	// Codegen end value
 	Value * end_value = end -> codegen();
 	if ( !end_value )
 		return nullptr;
 
-	// Store the value into the alloca.
-	Builder.CreateStore(start_value, info.first);
-
+	// The loop is entered only if it has at least one iteration, then it runs exactly
+	// |end - start| + 1 times and the control variable never steps past end
 	Function * parent = Builder.GetInsertBlock() -> getParent();
-	BasicBlock * condition_BB = BasicBlock::Create(TheContext, "for_condition", parent);
-	BasicBlock * body_BB = BasicBlock::Create(TheContext, "for_lopp", parent);
+	BasicBlock * preheader_BB = Builder.GetInsertBlock();
+	BasicBlock * header_BB = BasicBlock::Create(TheContext, "for_loop", parent);
+	BasicBlock * latch_BB = BasicBlock::Create(TheContext, "for_latch", parent);
 	BasicBlock * after_BB = BasicBlock::Create(TheContext, "after_block", parent);
 
-	// Condition
-	Builder.CreateBr(condition_BB);
-	Builder.SetInsertPoint(condition_BB);
-	Value * for_condition;
-	if ( downto )
-		for_condition = Builder.CreateICmpSGE(Builder.CreateLoad(info.first, variable_name), end_value);
-	else
-		for_condition = Builder.CreateICmpSLE(Builder.CreateLoad(info.first, variable_name), end_value);
-
-	Builder.CreateCondBr(for_condition, body_BB, after_BB);
-
-	// Loop branch
-	Builder.SetInsertPoint(body_BB);
+	Value * enter = downto ? Builder.CreateICmpSGE(start_value, end_value, "for_enter")
+	                       : Builder.CreateICmpSLE(start_value, end_value, "for_enter");
+	Builder.CreateCondBr(enter, header_BB, after_BB);
+
+	// The induction variable lives in a register, the body sees it through the variable
+	Builder.SetInsertPoint(header_BB);
+	PHINode * induction = Builder.CreatePHI(Type::getInt32Ty(TheContext), 2, variable_name);
+	induction -> addIncoming(start_value, preheader_BB);
+	Builder.CreateStore(induction, info.address);
+
+	// A local control variable can only change by the loop, so constant bounds are its range.
+	// Globals and var parameters may be changed by the routines called in the body.
+	ControlVariable range = {false, 0, 0};
+	auto start_constant = dyn_cast<ConstantInt>(start_value), end_constant = dyn_cast<ConstantInt>(end_value);
+	if ( start_constant && end_constant && isa<AllocaInst>(info.address) ) {
+		range.bounded = true;
+		range.min = downto ? end_constant -> getSExtValue() : start_constant -> getSExtValue();
+		range.max = downto ? start_constant -> getSExtValue() : end_constant -> getSExtValue();
+	}
 
-	if ( !body -> codegen() )
-		return nullptr;
+	{
+		ControlVariableScope control_scope(variable_name, range);
+		LoopScope scope(latch_BB, after_BB);
+		if ( !body -> codegen() )
+			return nullptr;
+	}
+	Builder.CreateBr(latch_BB);
 
-	// Calculate Next Value
-	Value * current_value = Builder.CreateLoad(info.first, variable_name);
-	Value * next_value = nullptr;
+	// Stepping can't overflow, the last iteration leaves before using the next value
+	Builder.SetInsertPoint(latch_BB);
 	Value * step_value = ConstantInt::get(TheContext, APInt(32, 1, true));
-	if ( downto )
-		next_value = Builder.CreateSub(current_value, step_value, "next_value");
-	else
-		next_value = Builder.CreateAdd(current_value, step_value, "next_value");
-
-	// Save to alloca
-	Builder.CreateStore(next_value, info.first);
-
-	Builder.CreateBr(condition_BB);
-
-
+	Value * next_value = downto ? Builder.CreateNSWSub(induction, step_value, "next_value")
+	                            : Builder.CreateNSWAdd(induction, step_value, "next_value");
+	Value * last = Builder.CreateICmpEQ(induction, end_value, "for_last");
+	BranchInst * back_edge = Builder.CreateCondBr(last, after_BB, header_BB);
+	induction -> addIncoming(next_value, latch_BB);
+
+	// Self referencing loop id, the loop passes record their transformations in it
+	auto placeholder = MDNode::getTemporary(TheContext, None);
+	MDNode * loop_id = MDNode::getDistinct(TheContext, {placeholder.get()});
+	loop_id -> replaceOperandWith(0, loop_id);
+	back_edge -> setMetadata(LLVMContext::MD_loop, loop_id);
 
 	// After for cycle
 	Builder.SetInsertPoint(after_BB);
@@ -400,6 +881,46 @@ Value * ASTFor::codegen()
 	return Constant::getNullValue(Type::getInt32Ty(TheContext));
 }
 
+/**
+ * Generates the calls in a loop condition that give the same result in every iteration
+ * at the insertion point, before the loop. Only a condition without side effects is
+ * changed, so that the order of the effects stays the same.
+ * @return the hoisted calls
+ */
+static std::vector<const ASTFunctionCall *> hoistInvariantCalls(ASTExpression & condition, ASTBody & body)
+{
+	Effects condition_effects;
+	condition.collectEffects(condition_effects);
+	RoutineEffects condition_calls = routine_effects.resolveCalls(condition_effects);
+	if ( condition_effects.unconditional_calls.empty() || condition_calls.purity == Purity::side_effects
+	     || condition_effects.io || !condition_effects.writes.empty() )
+		return {};
+
+	Effects loop_effects;
+	condition.collectEffects(loop_effects);
+	body.collectEffects(loop_effects);
+	RoutineEffects loop_calls = routine_effects.resolveCalls(loop_effects);
+	if ( loop_effects.unknown_calls )
+		return {};
+	std::set<std::string> loop_writes = loop_effects.writes;
+	loop_writes.insert(loop_calls.globals_written.begin(), loop_calls.globals_written.end());
+	// A call reading a var parameter sees the writes of the variable bound to it
+	routine_effects.addAliases(Builder.GetInsertBlock() -> getParent() -> getName().str(), loop_writes);
+
+	// Arguments come before their calls, so a hoisted call uses its hoisted arguments
+	std::vector<const ASTFunctionCall *> hoisted;
+	for ( ASTFunctionCall * call : condition_effects.unconditional_calls ) {
+		if ( !routine_effects.isInvariant(*call, loop_writes) )
+			continue;
+		Value * value = call -> codegen();
+		if ( !value )
+			break;
+		hoisted_calls[call] = value;
+		hoisted.push_back(call);
+	}
+	return hoisted;
+}
+
 Value * ASTWhile::codegen()
 {
 	Function * parent = Builder.GetInsertBlock() -> getParent();
@@ -407,23 +928,28 @@ Value * ASTWhile::codegen()
 	BasicBlock * body_BB = BasicBlock::Create(TheContext, "while_loop", parent);
 	BasicBlock * after_BB = BasicBlock::Create(TheContext, "after_block", parent);
 
+	std::vector<const ASTFunctionCall *> hoisted = hoistInvariantCalls(*condition, *body);
+	if ( TheReport )
+		TheReport -> hoisted_calls += hoisted.size();
+
 	// Condition
 	Builder.CreateBr(condition_BB);
 	Builder.SetInsertPoint(condition_BB);
 
-	Value * while_condition = condition -> codegen();
-	if ( !while_condition )
+	bool generated = condition -> codegenBranch(body_BB, after_BB);
+	for ( const ASTFunctionCall * call : hoisted )
+		hoisted_calls.erase(call);
+	if ( !generated )
 		return nullptr;
 
-	auto res = Builder.CreateICmpNE(while_condition, ConstantInt::get(TheContext, APInt(32, 0, true)));
-
-	Builder.CreateCondBr(res, body_BB, after_BB);
-
 
 	// Body
 	Builder.SetInsertPoint(body_BB);
-	if ( !(body -> codegen()) )
-		return nullptr;
+	{
+		LoopScope scope(condition_BB, after_BB);
+		if ( !(body -> codegen()) )
+			return nullptr;
+	}
 	Builder.CreateBr(condition_BB);
 
 
@@ -438,51 +964,101 @@ Value * ASTWhile::codegen()
 
 Value * ASTBreak::codegen ()
 {
-	auto parent = Builder.GetInsertBlock() -> getParent();
-	BasicBlock * after_BB = nullptr;
-
-	for ( auto & b : parent -> getBasicBlockList() ) {
-		if ( b.getName().startswith("after_block") ) {
-			after_BB = &b;
-			break;
-		}
-	}
-	if ( !after_BB )
-		return nullptr;
+	if ( loop_stack.empty() )
+		throw "break outside of a loop";
 
-	Builder.CreateBr(after_BB);
+	Builder.CreateBr(loop_stack.back().break_BB);
 
-	auto break_BB = BasicBlock::Create(TheContext, "after_break", parent);
+	// Statements following break are unreachable
+	auto break_BB = BasicBlock::Create(TheContext, "after_break", Builder.GetInsertBlock() -> getParent());
 	Builder.SetInsertPoint(break_BB);
 
 	return Constant::getNullValue(Type::getInt32Ty(TheContext));
 }
 
-Value * ASTExit::codegen ()
+Value * ASTContinue::codegen ()
 {
-	Function * parent = Builder.GetInsertBlock() -> getParent();
+	if ( loop_stack.empty() )
+		throw "continue outside of a loop";
 
-	BasicBlock * function_return_BB = nullptr;
+	Builder.CreateBr(loop_stack.back().continue_BB);
 
-	for ( BasicBlock & b : parent -> getBasicBlockList() ) {
-		if ( b.getName().startswith("return_block") ) {
-			function_return_BB = &b;
-			break;
-		}
-	}
-	if ( !function_return_BB )
-		return nullptr;
+	auto continue_BB = BasicBlock::Create(TheContext, "after_continue", Builder.GetInsertBlock() -> getParent());
+	Builder.SetInsertPoint(continue_BB);
 
+	return Constant::getNullValue(Type::getInt32Ty(TheContext));
+}
 
-	Builder.CreateBr(function_return_BB);
+Value * ASTExit::codegen ()
+{
+	Builder.CreateBr(exit_BB);
 
-	auto exit_BB = BasicBlock::Create(TheContext, "after_exit", parent);
-	Builder.SetInsertPoint(exit_BB);
+	auto after_exit_BB = BasicBlock::Create(TheContext, "after_exit", Builder.GetInsertBlock() -> getParent());
+	Builder.SetInsertPoint(after_exit_BB);
 
 	return Constant::getNullValue(Type::getInt32Ty(TheContext));
 }
 
 
+// Reports an index out of bounds and ends the program with exit code 201, like Turbo Pascal
+static Function * getRangeErrorFunction()
+{
+	Function * function = TheModule -> getFunction("pas_range_error");
+	if ( function )
+		return function;
+
+	Type * int_type = Type::getInt32Ty(TheContext);
+	FunctionType * function_type = FunctionType::get(Type::getVoidTy(TheContext), {int_type}, false);
+	function = Function::Create(function_type, Function::InternalLinkage, "pas_range_error", TheModule.get());
+	function -> addFnAttr(Attribute::NoReturn);
+	function -> addFnAttr(Attribute::Cold);
+
+	IRBuilder<> builder(BasicBlock::Create(TheContext, "entry", function));
+	codegenRuntimeError(builder, "Range check error: index %d out of bounds\n", {&*function -> arg_begin()}, 201);
+	return function;
+}
+
+/**
+ * Ends the program unless idx lies within the bounds of the array. Indices which are in range
+ * at compile time are not checked.
+ */
+static void codegenRangeCheck(const TVarInfo & info, const std::string & name, ASTExpression & index, Value * idx)
+{
+	if ( auto constant = dyn_cast<ConstantInt>(idx) ) {
+		int64_t value = constant -> getSExtValue();
+		if ( value >= info.lower_bound && value <= info.upper_bound )
+			return;
+		// Always fails, but only when the code runs, as on the interpreter and the VM
+		Builder.CreateCall(getRangeErrorFunction(), {idx});
+		Builder.CreateUnreachable();
+		Builder.SetInsertPoint(BasicBlock::Create(TheContext, "after_range_error", Builder.GetInsertBlock() -> getParent()));
+		return;
+	}
+	if ( auto reference = dynamic_cast<ASTSingleVarReference *>(&index) ) {
+		auto control_variable = control_variables.find(reference -> name);
+		if ( control_variable != control_variables.end() && control_variable -> second.bounded
+		     && control_variable -> second.min >= info.lower_bound && control_variable -> second.max <= info.upper_bound )
+			return;
+	}
+
+	// One unsigned compare covers both bounds, the shape the loop range check elimination expects
+	Type * int_type = Type::getInt32Ty(TheContext);
+	Value * offset = Builder.CreateSub(idx, ConstantInt::get(int_type, info.lower_bound, true), name + ".offset");
+	Value * in_range = Builder.CreateICmpULT(offset, ConstantInt::get(int_type, info.upper_bound - info.lower_bound + 1),
+	                                         name + ".in_range");
+
+	Function * parent = Builder.GetInsertBlock() -> getParent();
+	BasicBlock * error_BB = BasicBlock::Create(TheContext, "range_error", parent);
+	BasicBlock * checked_BB = BasicBlock::Create(TheContext, "in_range", parent);
+	Builder.CreateCondBr(in_range, checked_BB, error_BB, MDBuilder(TheContext).createBranchWeights(1 << 20, 1));
+
+	Builder.SetInsertPoint(error_BB);
+	Builder.CreateCall(getRangeErrorFunction(), {idx});
+	Builder.CreateUnreachable();
+
+	Builder.SetInsertPoint(checked_BB);
+}
+
 // Get variable value from stack
 Value * ASTSingleVarReference::codegen ()
 {
@@ -499,7 +1075,7 @@ Value * ASTSingleVarReference::codegen ()
 	else
 		throw "Using an undeclared variable";
 
-	return Builder.CreateLoad(info.first, name);
+	return Builder.CreateLoad(info.address, name);
 }
 // Find variable address
 Value * ASTSingleVarReference::getAlloca()
@@ -510,7 +1086,7 @@ Value * ASTSingleVarReference::getAlloca()
 	else if ( global_vars.find(name) != global_vars.cend() )
 		info = global_vars[name];
 
-	return info.first;
+	return info.address;
 }
 
 // Get array elem value from stack
@@ -529,21 +1105,22 @@ Value * ASTArrayReference::getAlloca()
 		info = global_vars[name];
 	else
 		throw "Undeclared array variable";
+	if ( !info.zero_element )
+		throw "Indexing " + name + ", which is not an array";
 
-	// Calculating elem address
-	std::vector<Value *> idx_list;
-	auto start_idx = std::dynamic_pointer_cast<ASTArray>(info.second) -> lowerIdx -> codegen();
-	auto idx = Builder.CreateSub(index -> codegen(), start_idx);
-
-	idx_list.push_back(ConstantInt::get(Type::getInt32Ty(TheContext), 0));
-	idx_list.push_back(idx);
-
-	return Builder.CreateGEP(info.first, idx_list);
+	Value * idx = index -> codegen();
+	if ( !idx )
+		return nullptr;
+	// Code of --tiered checks every index like the VM it replaces, {$R-} can't turn that off
+	if ( range_checked || TheOptions -> tiered )
+		codegenRangeCheck(info, name, *index, idx);
+	return Builder.CreateGEP(info.zero_element, idx, name);
 }
 
 Value * ASTAssignOp::codegen ()
 {
 	// Find alloca address of left side
+	checkAssignable(variable -> name);
 	Value * alloca = variable -> getAlloca();
 	if ( !alloca )
 		return nullptr;
@@ -558,8 +1135,109 @@ Value * ASTAssignOp::codegen ()
 }
 
 
+bool ASTExpression::codegenBranch(BasicBlock * if_true, BasicBlock * if_false)
+{
+	Value * value = codegen();
+	if ( !value )
+		return false;
+
+	Value * condition = Builder.CreateICmpNE(value, ConstantInt::get(TheContext, APInt(32, 0, true)), "condition");
+	Builder.CreateCondBr(condition, if_true, if_false);
+	return true;
+}
+
+bool ASTBinaryOperator::isComparison() const
+{
+	return op == tok_equal || op == tok_notEqual || op == tok_less || op == tok_lessEqual
+	       || op == tok_greater || op == tok_greaterEqual;
+}
+
+// Integer and/or stay bitwise
+bool ASTBinaryOperator::isShortCircuit() const
+{
+	return (op == tok_kwAnd || op == tok_kwOr) && LHS -> isBoolean() && RHS -> isBoolean();
+}
+
+bool ASTBinaryOperator::isBoolean() const
+{
+	return isComparison() || isShortCircuit();
+}
+
+// i1 result of a comparison
+Value * ASTBinaryOperator::codegenComparison()
+{
+	Value * left = LHS -> codegen();
+	Value * right = RHS -> codegen();
+
+	if ( !left || !right )
+		return nullptr;
+
+	switch ( op ) {
+		case tok_equal:
+			return Builder.CreateICmpEQ(left, right, "eq");
+		case tok_notEqual:
+			return Builder.CreateICmpNE(left, right, "neq");
+		case tok_less:
+			return Builder.CreateICmpSLT(left, right, "less");
+		case tok_lessEqual:
+			return Builder.CreateICmpSLE(left, right, "lessEq");
+		case tok_greater:
+			return Builder.CreateICmpSGT(left, right, "greater");
+		default:
+			return Builder.CreateICmpSGE(left, right, "greaterEq");
+	}
+}
+
+bool ASTBinaryOperator::codegenBranch(BasicBlock * if_true, BasicBlock * if_false)
+{
+	if ( isComparison() ) {
+		Value * condition = codegenComparison();
+		if ( !condition )
+			return false;
+		Builder.CreateCondBr(condition, if_true, if_false);
+		return true;
+	}
+
+	if ( !isShortCircuit() )
+		return ASTExpression::codegenBranch(if_true, if_false);
+
+	// The right operand is only reached when the left one doesn't decide
+	Function * parent = Builder.GetInsertBlock() -> getParent();
+	BasicBlock * right_BB = BasicBlock::Create(TheContext, op == tok_kwAnd ? "and_right" : "or_right", parent);
+	if ( op == tok_kwAnd ? !LHS -> codegenBranch(right_BB, if_false) : !LHS -> codegenBranch(if_true, right_BB) )
+		return false;
+
+	Builder.SetInsertPoint(right_BB);
+	return RHS -> codegenBranch(if_true, if_false);
+}
+
 Value * ASTBinaryOperator::codegen ()
 {
+	if ( isComparison() ) {
+		Value * condition = codegenComparison();
+		return condition ? Builder.CreateIntCast(condition, Type::getInt32Ty(TheContext), true) : nullptr;
+	}
+
+	if ( isShortCircuit() ) {
+		Function * parent = Builder.GetInsertBlock() -> getParent();
+		BasicBlock * true_BB = BasicBlock::Create(TheContext, "bool_true", parent);
+		BasicBlock * false_BB = BasicBlock::Create(TheContext, "bool_false", parent);
+		BasicBlock * after_BB = BasicBlock::Create(TheContext, "bool_value", parent);
+		if ( !codegenBranch(true_BB, false_BB) )
+			return nullptr;
+
+		Builder.SetInsertPoint(true_BB);
+		Builder.CreateBr(after_BB);
+		Builder.SetInsertPoint(false_BB);
+		Builder.CreateBr(after_BB);
+
+		Builder.SetInsertPoint(after_BB);
+		PHINode * value = Builder.CreatePHI(Type::getInt32Ty(TheContext), 2, "bool");
+		value -> addIncoming(ConstantInt::get(TheContext, APInt(32, -1, true)), true_BB);
+		value -> addIncoming(ConstantInt::get(TheContext, APInt(32, 0, true)), false_BB);
+		return value;
+	}
+
 	Value * left = LHS -> codegen();
 	Value * right = RHS -> codegen();
 
@@ -583,40 +1261,30 @@ Value * ASTBinaryOperator::codegen ()
 		case tok_kwMod:
 			bit_result = Builder.CreateSRem(left, right, "mod");
 			break;
-		case tok_equal:
-			bit_result = Builder.CreateICmpEQ(left, right, "eq");
-			break;
-		case tok_notEqual:
-			bit_result = Builder.CreateICmpNE(left, right, "neq");
-			break;
-		case tok_less:
-			bit_result = Builder.CreateICmpSLT(left, right, "less");
-			break;
-		case tok_lessEqual:
-			bit_result = Builder.CreateICmpSLE(left, right, "lessEq");
-			break;
-		case tok_greater:
-			bit_result = Builder.CreateICmpSGT(left, right, "greater");
-			break;
-		case tok_greaterEqual:
-			bit_result = Builder.CreateICmpSGE(left, right, "greaterEq");
-			break;
 		case tok_kwAnd:
 			bit_result = Builder.CreateAnd(left, right, "and");
 			break;
 		case tok_kwOr:
 			bit_result = Builder.CreateOr(left, right, "or");
 			break;
+		// Shift counts are taken modulo 32 as on x86, larger ones would be undefined
+		case tok_kwShl:
+			bit_result = Builder.CreateShl(left, Builder.CreateAnd(right, 31), "shl");
+			break;
+		case tok_kwShr:
+			bit_result = Builder.CreateLShr(left, Builder.CreateAnd(right, 31), "shr");
+			break;
 		default:
 			bit_result = nullptr;
 			break;
 	}
-	return Builder.CreateIntCast(bit_result, Type::getInt32Ty(TheContext), true);
+	return bit_result;
 }
 
 
 
-Value * ASTProgram::codegen ()
+// Declares the runtime functions and main, returns the block the main body goes to
+static BasicBlock * declareProgram()
 {
 	// Printf and scanf declarations
 	PointerType * ptr = PointerType::get(IntegerType::get(TheContext, 8), 0);
@@ -641,110 +1309,226 @@ Value * ASTProgram::codegen ()
 	string_specifier_character = Builder.CreateGlobalStringPtr("%s");
 	new_line_specifier = Builder.CreateGlobalStringPtr("\n");
 
+	return program_BB;
+}
 
-	for ( auto & var : global )
-		var -> codegen();
+// Generates the main body and returns from main
+static Value * defineMain(BasicBlock * program_BB, ASTBody & main)
+{
+	PhaseTimer timer(TheReport, "IR generation: main");
+	if ( TheReport )
+		for ( auto & count : routine_effects.countRoutines() )
+			TheReport -> routines[purityName(count.first)] = count.second;
+	Builder.SetInsertPoint(program_BB);
+	const_parameters.clear();
+	tail_recursion = TailRecursion();
+	// exit in the main program ends the program
+	exit_BB = BasicBlock::Create(TheContext, "return_block: main", program_BB -> getParent());
 
-	for ( auto & f : functions )
-		f -> codegen();
+	bool generated = main.codegen() != nullptr;
+	Builder.CreateBr(exit_BB);
+	Builder.SetInsertPoint(exit_BB);
+	return Builder.CreateRet(ConstantInt::get(TheContext, APInt(32, generated ? 0 : 1, false)));
+}
 
-	Builder.SetInsertPoint(program_BB);
-	auto v = main -> codegen();
-	if ( v )
-		return Builder.CreateRet(ConstantInt::get(TheContext, APInt(32, 0, false)));
-	else
-		return Builder.CreateRet(ConstantInt::get(TheContext, APInt(32, 1, false)));
+// Pure routines can be run by the compiler, so constant expressions can call them
+static bool addConstantRoutine(ASTFunction & function)
+{
+	const RoutineEffects * effects = routine_effects.find(function.getName());
+	if ( !effects || effects -> purity != Purity::pure )
+		return false;
+	constant_evaluator.addRoutine(function);
+	return true;
 }
 
+Value * ASTProgram::codegen ()
+{
+	BasicBlock * program_BB = declareProgram();
+
+	{
+		PhaseTimer timer(TheReport, "Side effect analysis");
+		for ( auto & var : global )
+			if ( auto variable = dynamic_cast<ASTVariable *>(var.get()) )
+				routine_effects.addGlobal(variable -> name);
+		for ( auto & f : functions )
+			routine_effects.addRoutine(*f);
+		routine_effects.analyze();
+	}
 
-// Does the magic
-std::unique_ptr<Module> ASTProgram::runCodegen(const std::string & output_file)
-{
-	// Create a new pass manager attached to it.
-	//	TheFPM = llvm::make_unique<legacy::FunctionPassManager>(TheModule.get());
-	/*
-	// Promote allocas to registers.
-	TheFPM->add(createPromoteMemoryToRegisterPass());
-	// Do simple "peephole" optimizations and bit-twiddling optzns.
-	TheFPM->add(createInstructionCombiningPass());
-	// Reassociate expressions.
-	TheFPM->add(createReassociatePass());
-	// Eliminate Common SubExpressions.
-	TheFPM->add(createGVNPass());
-	// Simplify the control flow graph (deleting unreachable blocks, etc).
-	TheFPM->add(createCFGSimplificationPass());
-
-	TheFPM->doInitialization();*/
+	{
+		PhaseTimer timer(TheReport, "IR generation: globals");
+		// Constant expressions can only call the routines declared before them
+		size_t declared = 0;
+		for ( size_t i = 0; i < global.size(); i++ ) {
+			for ( ; i < routines_before.size() && declared < routines_before[i]; declared++ )
+				addConstantRoutine(*functions[declared]);
+			global[i] -> codegen();
+		}
+		for ( ; declared < functions.size(); declared++ )
+			addConstantRoutine(*functions[declared]);
+	}
 
+	{
+		PhaseTimer timer(TheReport, "IR generation: routines");
+		for ( auto & f : functions )
+			f -> codegen();
+	}
+
+	return defineMain(program_BB, *main);
+}
+
+
+// Starts a new module, the state may be left over from a previous compilation on this thread
+static void startModule(const CompileOptions & options, CompileReport * report)
+{
+	named_values.clear();
+	global_vars.clear();
+	const_vars.clear();
+	routine_parameters.clear();
+	const_parameters.clear();
+	routine_effects.clear();
+	constant_evaluator.clear();
+	hoisted_calls.clear();
+	tail_recursion = TailRecursion();
+	control_variables.clear();
+	loop_stack.clear();
+	exit_BB = nullptr;
+	TheOptions = &options;
+	TheReport = report;
+
+	// Sizes of the types are known while generating the IR
 	TheModule = make_unique<Module>("main_module", TheContext);
+	TheModule -> setTargetTriple(options.target_triple);
+	TheModule -> setDataLayout(getTargetMachine(options.target_triple) -> createDataLayout());
+}
 
-	auto res = codegen();
+// Builds the LLVM module of the whole program
+std::unique_ptr<Module> ASTProgram::generateModule(const CompileOptions & options, CompileReport * report)
+{
+	startModule(options, report);
 
+	auto res = codegen();
 
 	if ( !res )
 		return nullptr;
 
-	// llvm::outs() raw_ostream for std::cout
-	TheModule -> print(outs(), nullptr);
+	return std::move(TheModule);
+}
 
+StreamingCodegen::StreamingCodegen(const CompileOptions & options, CompileReport * report)
+	: options(options), report(report) {}
 
+void StreamingCodegen::startProgram(const std::string &)
+{
+	startModule(options, report);
+	main_block = declareProgram();
+}
 
-	// GENERATE OBJECT FILE
-	// Initialize the target registry etc.
-	InitializeAllTargetInfos();
-	InitializeAllTargets();
-	InitializeAllTargetMCs();
-	InitializeAllAsmParsers();
-	InitializeAllAsmPrinters();
-
-	auto TargetTriple = sys::getDefaultTargetTriple();
-	TheModule->setTargetTriple(TargetTriple);
-
-	std::string Error;
-	auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
-
-	// Print an error and exit if we couldn't find the requested target.
-	// This generally occurs if we've forgotten to initialise the
-	// TargetRegistry or we have a bogus target triple.
-	if (!Target) {
-		errs() << Error;
-		return nullptr;
-	}
+void StreamingCodegen::addGlobal(std::unique_ptr<ASTVariableDef> global)
+{
+	PhaseTimer timer(report, "IR generation: globals");
+	global -> codegen();
+}
 
-	auto CPU = "generic";
-	auto Features = "";
+void StreamingCodegen::addFunction(std::unique_ptr<ASTFunction> function)
+{
+	PhaseTimer timer(report, "IR generation: routines");
+	// Only the routines before it are known, calls of later ones count as side effects
+	routine_effects.addRoutine(*function);
+	routine_effects.summarize(function -> getName());
+	function -> codegen();
+	// The compiler may run a pure routine later, its AST is kept for that
+	if ( addConstantRoutine(*function) )
+		constant_routines.push_back(std::move(function));
+}
 
-	TargetOptions opt;
-	auto RM = Optional<Reloc::Model>();
-	auto TheTargetMachine =	Target -> createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+void StreamingCodegen::finishProgram(std::unique_ptr<ASTBody> main)
+{
+	defineMain(main_block, *main);
+}
 
-	TheModule -> setDataLayout(TheTargetMachine->createDataLayout());
+std::unique_ptr<Module> StreamingCodegen::takeModule()
+{
+	return std::move(TheModule);
+}
 
-	std::error_code EC;
-	raw_fd_ostream dest(output_file, EC, sys::fs::F_None);
+// Does the magic
+void emitModule(std::unique_ptr<Module> module, const CompileOptions & options, raw_ostream & out, CompileReport * report)
+{
+	const std::string & output_file = options.output_file;
 
-	if (EC) {
-		errs() << "Could not open file: " << EC.message();
-		return nullptr;
+	if ( !module )
+		throw std::string("Code generation failed");
+
+
+	// GENERATE OBJECT FILE
+	auto TargetTriple = options.target_triple;
+	module->setTargetTriple(TargetTriple);
+
+	auto TheTargetMachine = getTargetMachine(TargetTriple);
+
+	module -> setDataLayout(TheTargetMachine->createDataLayout());
+
+	{
+		// Also in release builds, the phase would time nothing there
+		PhaseTimer timer(report, "IR verification");
+		if ( verifyModule(*module, &errs()) )
+			throw std::string("Generated IR is invalid");
 	}
 
-	legacy::PassManager pass;
-	auto file_type = TargetMachine::CGFT_ObjectFile;
+	optimizeModule(*module, options.opt_level, TheTargetMachine, report);
+	if ( report )
+		report -> countIR(*module);
 
-	if (TheTargetMachine -> addPassesToEmitFile(pass, dest, file_type)) {
-		errs() << "TheTargetMachine can't emit a file of this type";
-		return nullptr;
+	if ( options.print_ir )
+		module -> print(out, nullptr);
+
+	// Executables are linked from a temporary object file
+	std::string object_file = output_file;
+	if ( options.executable ) {
+		SmallString<128> temp_path;
+		if ( std::error_code EC = sys::fs::createTemporaryFile("pas_compiler", "o", temp_path) )
+			throw "Could not create temporary file: " + EC.message();
+		object_file = temp_path.str().str();
 	}
 
-	assert(!verifyModule(*TheModule, &errs()));
+	bool text_output = options.emit == emit_llvm || options.emit == emit_assembly;
+	// Replace rather than overwrite, the old output may be hard linked into the compile cache
+	sys::fs::remove(output_file);
 
-	pass.run(*TheModule);
+	PhaseTimer emit_timer(report, "Code emission");
+	std::error_code EC;
+	raw_fd_ostream dest(object_file, EC, text_output ? sys::fs::F_Text : sys::fs::F_None);
 
-	dest.flush();
+	if (EC)
+		throw "Could not open file: " + EC.message();
+
+	if ( options.emit == emit_llvm ) {
+		module -> print(dest, nullptr);
+	} else if ( options.emit == emit_bitcode ) {
+		WriteBitcodeToFile(module.get(), dest);
+	} else {
+		TracingPassManager<legacy::PassManager> pass;
+		auto file_type = options.emit == emit_assembly ? TargetMachine::CGFT_AssemblyFile : TargetMachine::CGFT_ObjectFile;
 
-	outs() << "Wrote " << output_file << "\n";
+		if (TheTargetMachine -> addPassesToEmitFile(pass, dest, file_type))
+			throw std::string("TheTargetMachine can't emit a file of this type");
 
-	return nullptr;
+		pass.run(*module);
+	}
+
+	dest.flush();
+	emit_timer.stop();
+
+	if ( options.executable ) {
+		dest.close();
+		PhaseTimer timer(report, "Linking");
+		std::string link_error;
+		bool linked = linkExecutable(object_file, output_file, link_error);
+		sys::fs::remove(object_file);
+		if ( !linked )
+			throw "Linking failed: " + link_error;
+	}
 }
 
 
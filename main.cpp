@@ -1,34 +1,56 @@
-#include "Parser.h"
+#include "Driver.h"
+#include "Server.h"
+#include "Trace.h"
+
+#include <algorithm>
 
 #include <iostream>
 #include <fstream>
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/StringSaver.h"
 
 
 
 int main(int argc, char * argv[])
 {
-    std::string input_file;
-    std::string output_file = "output.o";
-    if ( argc != 2 ) {
-        printf("Usage: %s <input_file>\n", argv[0]);
-        return 1;
-    }
-    input_file = argv[1];
-
-    Parser parser(input_file);
-
-    try {
-        std::unique_ptr<ASTProgram> parsed_program(parser.start());
-
-        parsed_program -> runCodegen(output_file);
-
-    } catch (const char * exception) {
-        printf("Error while compiling %s\n", input_file.c_str());
-        printf("%s\n", exception);
-        return 2;
-    }
-
-    return 0;
+	// Replace @file arguments by the arguments listed in the file
+	llvm::SmallVector<const char *, 64> arguments(argv, argv + argc);
+	llvm::BumpPtrAllocator allocator;
+	llvm::StringSaver saver(allocator);
+	if ( !llvm::cl::ExpandResponseFiles(saver, llvm::cl::TokenizeGNUCommandLine, arguments) ) {
+		printf("Could not read a response file\n");
+		return 1;
+	}
+
+	CompileOptions options;
+	std::string error;
+	if ( !parseOptions(arguments.size(), arguments.data(), options, error) ) {
+		printf("%s\n", error.c_str());
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	if ( !options.serve_socket.empty() )
+		return runServer(options.serve_socket, options.server_threads);
+
+	// The JIT, the interpreter and the VM run the program and a trace describes this process, all have to happen here
+	int exit_code;
+	bool local = options.jit || options.interpret || options.vm || options.tiered || !options.trace_file.empty();
+	if ( !options.connect_socket.empty() && !local && forwardToServer(options.connect_socket, arguments.size(), arguments.data(), exit_code) )
+		return exit_code;
+
+	if ( !options.trace_file.empty() )
+		enableTracing();
+
+	exit_code = compileInputs(options, llvm::outs());
+
+	if ( !options.trace_file.empty() && !writeTrace(options.trace_file, error) ) {
+		printf("Could not write trace %s: %s\n", options.trace_file.c_str(), error.c_str());
+		return std::max(exit_code, 1);
+	}
+	return exit_code;
 }
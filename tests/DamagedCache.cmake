@@ -0,0 +1,43 @@
+# Damages the bytecode cached for PROGRAM.pas; the VM has to reject the entry, compile the program
+# again and replace the entry
+file(REMOVE_RECURSE ${CACHE_DIR})
+file(READ ${SOURCE_DIR}/${PROGRAM}.out expected_output)
+
+function(run_cached cache_state)
+	execute_process(COMMAND ${COMPILER} --vm --cache-dir=${CACHE_DIR} ${PROGRAM}.pas WORKING_DIRECTORY ${SOURCE_DIR}
+		RESULT_VARIABLE code OUTPUT_VARIABLE output ERROR_VARIABLE errors)
+	if ( NOT code STREQUAL "0" OR NOT output STREQUAL expected_output OR NOT errors STREQUAL "" )
+		message(FATAL_ERROR "--vm with ${cache_state} exited with ${code}:\n${output}${errors}")
+	endif ()
+endfunction()
+
+function(check_replaced entry intact cache_state)
+	file(READ ${entry} replaced HEX)
+	if ( NOT replaced STREQUAL intact )
+		message(FATAL_ERROR "The entry with ${cache_state} was kept")
+	endif ()
+endfunction()
+
+run_cached("an empty cache")
+file(GLOB entry ${CACHE_DIR}/llvmcache-*)
+list(LENGTH entry entries)
+if ( NOT entries EQUAL 1 )
+	message(FATAL_ERROR "Expected one cache entry, found ${entries}")
+endif ()
+file(READ ${entry} intact HEX)
+run_cached("an intact entry")
+
+# The main program is the last function and ends with halt, its last word becomes a ret
+string(LENGTH "${intact}" length)
+math(EXPR last_word "${length} / 2 - 4")
+execute_process(COMMAND sh -c "printf '\\001' | dd of='${entry}' bs=1 seek=${last_word} conv=notrunc" ERROR_QUIET)
+file(READ ${entry} damaged HEX)
+if ( damaged STREQUAL intact )
+	message(FATAL_ERROR "Could not damage ${entry}")
+endif ()
+run_cached("a ret in the main program")
+check_replaced(${entry} "${intact}" "a ret in the main program")
+
+file(APPEND ${entry} "damaged")
+run_cached("trailing data")
+check_replaced(${entry} "${intact}" "trailing data")
@@ -0,0 +1,19 @@
+# Runs PROGRAM.pas with --MODE, its exit code has to be EXIT_CODE and its output the expected one
+execute_process(COMMAND ${COMPILER} --${MODE} ${PROGRAM}.pas WORKING_DIRECTORY ${SOURCE_DIR}
+	RESULT_VARIABLE code OUTPUT_VARIABLE output ERROR_VARIABLE errors)
+
+file(READ ${SOURCE_DIR}/${PROGRAM}.out expected_output)
+set(expected_errors "")
+if ( EXISTS ${SOURCE_DIR}/${PROGRAM}.err )
+	file(READ ${SOURCE_DIR}/${PROGRAM}.err expected_errors)
+endif ()
+
+if ( NOT code STREQUAL EXIT_CODE )
+	message(FATAL_ERROR "--${MODE} exited with ${code} instead of ${EXIT_CODE}\n${output}${errors}")
+endif ()
+if ( NOT output STREQUAL expected_output )
+	message(FATAL_ERROR "Output of --${MODE}:\n${output}Expected:\n${expected_output}")
+endif ()
+if ( NOT errors STREQUAL expected_errors )
+	message(FATAL_ERROR "Errors of --${MODE}:\n${errors}Expected:\n${expected_errors}")
+endif ()
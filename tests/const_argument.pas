@@ -0,0 +1,18 @@
+# A const array can't be passed on to a var parameter
+program const_argument;
+var a : array [1 .. 3] of integer;
+
+procedure fill(var b : array [1 .. 3] of integer);
+begin
+  b[1] := 7;
+end;
+
+procedure pass(const c : array [1 .. 3] of integer);
+begin
+  fill(c);
+end;
+
+begin
+  pass(a);
+  writeln(a[1]);
+end.
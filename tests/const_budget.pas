@@ -0,0 +1,16 @@
+# A constant has to be computed at compile time, within the evaluator's budget
+program const_budget;
+
+function spin(n : integer) : integer;
+var i, s : integer;
+begin
+  s := 0;
+  for i := 1 to n do s := (s + i) mod 1000;
+  spin := s;
+end;
+
+const c = spin(10000000);
+
+begin
+  writeln(c);
+end.
@@ -0,0 +1,24 @@
+# A constant index out of bounds is an error only when the access runs
+program constant_index;
+{$R+}
+const n = 4;
+var a : array [1 .. 3] of integer;
+var k : integer;
+
+function next(x : integer) : integer;
+begin
+  next := x + 1;
+end;
+
+procedure never();
+begin
+  a[n] := 1;
+end;
+
+begin
+  a[1] := 2;
+  k := 0;
+  if k = 1 then never();
+  writeln(a[1]);
+  writeln(a[next(3)]);
+end.
@@ -0,0 +1,23 @@
+# Calls too large to evaluate at compile time are left to run time
+program evaluator_budget;
+
+function deep(n : integer) : integer;
+var a : array [1 .. 100000] of integer;
+begin
+  a[n + 1] := n;
+  if n = 0 then deep := 0
+  else deep := deep(n - 1) + a[n + 1];
+end;
+
+function spin(n : integer) : integer;
+var i, s : integer;
+begin
+  s := 0;
+  for i := 1 to n do s := (s + i) mod 1000;
+  spin := s;
+end;
+
+begin
+  writeln(deep(100));
+  writeln(spin(10000000));
+end.
@@ -0,0 +1,21 @@
+# A hot routine is compiled with the routines it calls, which the VM never called itself
+program hot_callees;
+var i, s : integer;
+var a : array [0 .. 6] of integer;
+
+function leaf(x : integer) : integer;
+begin
+  leaf := a[x mod 7];
+end;
+
+function middle(x : integer) : integer;
+begin
+  if x mod 2000 = 1999 then middle := leaf(x) else middle := 1;
+end;
+
+begin
+  for i := 0 to 6 do a[i] := i * i;
+  s := 0;
+  for i := 1 to 300000 do s := s + middle(i);
+  writeln(s);
+end.
@@ -0,0 +1,13 @@
+# Switches of a directive are separated by commas and may be padded, the unknown ones are reported
+program range_directive;
+{$R- }
+var a : array [0 .. 2] of integer;
+var i : integer;
+begin
+  {$Q+, R+}
+  i := 2;
+  a[i] := 5;
+  writeln(a[i]);
+  i := i + 1;
+  writeln(a[i]);
+end.
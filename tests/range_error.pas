@@ -0,0 +1,19 @@
+# An index out of bounds ends the program with runtime error 201 in every backend
+program range_error;
+{$R+}
+var a : array [1 .. 10] of integer;
+var i, s : integer;
+
+function get(k : integer) : integer;
+begin
+  get := a[k];
+end;
+
+begin
+  for i := 1 to 10 do a[i] := i;
+  s := 0;
+  for i := 1 to 5000 do s := s + get(i mod 10 + 1);
+  writeln(s);
+  writeln(get(11));
+  writeln(0);
+end.
@@ -0,0 +1,17 @@
+# Runaway recursion ends with runtime error 202 after the same depth in the interpreter and the VM
+program stack_overflow;
+var n : integer;
+
+function depth(k : integer) : integer;
+begin
+  n := n + 1;
+  if k = 0 then depth := 0
+  else depth := depth(k - 1) + 1;
+end;
+
+begin
+  n := 0;
+  writeln(depth(199998));
+  writeln(depth(200000));
+  writeln(n);
+end.
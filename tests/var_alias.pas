@@ -0,0 +1,27 @@
+# A var parameter and the global bound to it are one variable
+program var_alias;
+var g, calls : integer;
+
+function f(x : integer) : integer;
+begin
+  f := x;
+end;
+
+procedure count(var v : integer);
+begin
+  while f(v) < 10 do g := g + 1;
+end;
+
+procedure twice(var x : integer; var y : integer);
+begin
+  while f(x) < 7 do y := y + 1;
+end;
+
+begin
+  g := 0;
+  count(g);
+  calls := 0;
+  twice(calls, calls);
+  writeln(g);
+  writeln(calls);
+end.